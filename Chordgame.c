@@ -16,1079 +16,4999 @@
 
 #include <unistd.h>
 
+#include <pthread.h>
 
+#include <stdatomic.h>
 
-#define SAMPLE_RATE 48000
+#include <stdint.h>
 
-#define BUFFER_SIZE 144000
+#include <sched.h>
 
-#define NUM_NOTES 12
+#include <errno.h>
 
-#define NUM_OCTAVES 9
+#include <signal.h>
 
-#define MIN_OCTAVE 0
+#include <sys/mman.h>
 
-#define MAX_OCTAVE 8
+#include <sys/stat.h>
 
-#define MAX_SCALE_LENGTH 100
+#include <sys/syscall.h>
 
-#define ANSI_COLOUR_RED     "\x1b[31m"
+#include <sys/wait.h>
 
-#define ANSI_COLOUR_GREEN     "\x1b[32m"
+#include <linux/futex.h>
 
-#define ANSI_COLOUR_RESET     "\x1b[0m"
+#include "chordengine.h"
 
-#define ANSI_CLEAR_CONSOLE "\e[1;1H\e[2J"
+#include "chordshm.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
 
+#ifdef CHORDGAME_RT_DEBUG
+#include <dlfcn.h>
+#endif
 
-const char* note_names[NUM_NOTES] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
 
-const char* enharmonic_equivalents[NUM_NOTES] = {"C", "db", "D", "eb", "E", "F", "gb", "G", "ab", "A", "bb", "B"};
 
-const char* valid_notes[] = {"C", "c", "C#", "c#", "Db", "db", "D", "d", "D#", "d#", "Eb", "eb", "E", "e", "F", "f", "F#", "f#", "Gb", "gb", "G", "g", "Ab", "ab", "A", "a", "A#", "a#", "Bb", "bb", "B", "b","r","R","s","S","q","Q"};
+#define SAMPLE_RATE 48000
 
-const int num_valid_notes = sizeof(valid_notes) / sizeof(valid_notes[0]);
+#define BUFFER_SIZE 144000
 
+#define NUM_NOTES CE_NUM_NOTES
 
+#define NUM_OCTAVES CE_NUM_OCTAVES
 
+#define MIN_OCTAVE CE_MIN_OCTAVE
 
+#define MAX_OCTAVE CE_MAX_OCTAVE
 
+#define MAX_SCALE_LENGTH CE_MAX_POOL
 
+#define ANSI_COLOUR_RED     "\x1b[31m"
 
-// Normalize the note name (both to lowercase)
+#define ANSI_COLOUR_GREEN     "\x1b[32m"
 
-void normalize_note_name(const char* input, char* output) {
+#define ANSI_COLOUR_RESET     "\x1b[0m"
 
-    int i = 0;
+#define ANSI_CLEAR_CONSOLE "\e[1;1H\e[2J"
 
-    while (input[i] != '\0') {
 
-        output[i] = tolower((unsigned char)input[i]); // Convert everything to lowercase
 
-        i++;
+typedef CeNote Note;
 
-    }
 
-    output[i] = '\0';
 
-}
+// --- Tuning systems ---
+// The engine precomputes frequencies into current_tuning.frequency_table when a tuning
+// is selected, so get_frequency is a plain table lookup.
 
+typedef CeTuning Tuning;
 
+Tuning current_tuning;
 
-// Normalize input and find corresponding pitch class index (0–11), or -1 if invalid
+double a4_frequency = CE_DEFAULT_A4;
 
-int get_pitch_class_from_note(const char* note) {
+// Get the frequency of the note based on its step (the pitch class in 12-step tunings) and octave
+double get_frequency(int step, int octave) {
+    return ce_tuning_frequency(&current_tuning, step, octave);
+}
 
-    char normalized[4];
+// Frequency of a 12-tone pitch class: from the tuning when it is 12-step, otherwise equal
+// tempered on the A reference. For keyboards, self-tests and benchmarks that pick notes by name.
+double pitch_class_frequency(int pitch_class, int octave) {
+    if (current_tuning.steps_per_octave == NUM_NOTES) {
+        return get_frequency(pitch_class, octave);
+    }
+    return a4_frequency * pow(2.0, (ce_note_number(pitch_class, octave) - CE_CONCERT_A_NOTE_NUMBER) / 12.0);
+}
 
-    normalize_note_name(note, normalized);
+// --- Equal-loudness compensation ---
+// Each note is scaled by the engine's ISO 226 equal-loudness gain for loudness_phon. The
+// gains are precomputed per table note whenever the tuning is loaded, so the renderers
+// only do a lookup.
 
+#define DEFAULT_LOUDNESS_PHON CE_DEFAULT_LOUDNESS_PHON
 
+double loudness_phon = DEFAULT_LOUDNESS_PHON;  // 0 = compensation off
+double loudness_table[NUM_OCTAVES][CE_MAX_TUNING_STEPS];
 
-    for (int i = 0; i < NUM_NOTES; i++) {
+double get_loudness_gain(int step, int octave) {
+    if (octave < MIN_OCTAVE || octave > MAX_OCTAVE) {
+        return ce_loudness_gain(get_frequency(step, octave), loudness_phon);
+    }
+    return loudness_table[octave][step];
+}
 
-        char name_norm[4], enh_norm[4];
 
-        normalize_note_name(note_names[i], name_norm);
 
-        normalize_note_name(enharmonic_equivalents[i], enh_norm);
+// --- Phase tracing ---
+// Built with -DCHORDGAME_TRACE, -trace <file.json> records named spans into a per-thread
+// ring and writes them on exit in the Chrome trace event format (chrome://tracing,
+// ui.perfetto.dev). Without the define the TRACE_ macros compile to nothing. Threads that
+// are still running at exit (a prefetch, the audio callback) stop recording once the
+// trace is closed, and the flush waits for any span they are part way through writing.
 
+#ifdef CHORDGAME_TRACE
 
+#define TRACE_RING_EVENTS 8192  // per thread; the oldest spans are overwritten
 
-        if (strcmp(normalized, name_norm) == 0 || strcmp(normalized, enh_norm) == 0) {
+typedef struct {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+} TraceEvent;
+
+typedef struct TraceRing {
+    TraceEvent events[TRACE_RING_EVENTS];
+    unsigned long count;
+    int track;                // Chrome "tid"; rings of finished threads are reused
+    atomic_int in_use;
+    atomic_int writing;       // owner is recording an event
+    struct TraceRing* next;
+} TraceRing;
+
+const char* trace_path = NULL;
+static TraceRing* trace_rings = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key;
+static __thread TraceRing* trace_ring = NULL;
+static uint64_t trace_origin_ns;
+static atomic_int trace_closed = 0;
+
+static inline uint64_t trace_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
 
-            return i;
+static void trace_release_ring(void* ring) {
+    atomic_store(&((TraceRing*)ring)->in_use, 0);
+}
 
+// Claim a ring left by a finished thread, or register a new one
+static TraceRing* trace_thread_ring(void) {
+    if (trace_ring != NULL) {
+        return trace_ring;
+    }
+    pthread_mutex_lock(&trace_lock);
+    int tracks = 0;
+    for (TraceRing* ring = trace_rings; ring != NULL; ring = ring->next, tracks++) {
+        int idle = 0;
+        if (atomic_compare_exchange_strong(&ring->in_use, &idle, 1)) {
+            trace_ring = ring;
+            break;
         }
-
     }
+    if (trace_ring == NULL && (trace_ring = calloc(1, sizeof(TraceRing))) != NULL) {
+        trace_ring->track = tracks + 1;
+        atomic_store(&trace_ring->in_use, 1);
+        trace_ring->next = trace_rings;
+        trace_rings = trace_ring;
+    }
+    pthread_mutex_unlock(&trace_lock);
+    if (trace_ring != NULL) {
+        pthread_setspecific(trace_key, trace_ring);
+    }
+    return trace_ring;
+}
 
+static void trace_record(const char* name, uint64_t start_ns) {
+    TraceRing* ring = trace_thread_ring();
+    if (ring == NULL) {
+        return;
+    }
+    // Sequentially consistent, paired with trace_flush: either the flush sees this write
+    // in progress and waits for it, or this thread sees the trace closed
+    atomic_store(&ring->writing, 1);
+    if (!atomic_load(&trace_closed)) {
+        TraceEvent* event = &ring->events[ring->count++ % TRACE_RING_EVENTS];
+        event->name = name;
+        event->start_ns = start_ns;
+        event->duration_ns = trace_now_ns() - start_ns;
+    }
+    atomic_store(&ring->writing, 0);
+}
 
-
-    return -1;
-
+// Close the trace and write every ring as complete ("X") events; registered with atexit
+static void trace_flush(void) {
+    atomic_store(&trace_closed, 1);
+    FILE* file = fopen(trace_path, "w");
+    if (file == NULL) {
+        printf("Error: Could not write trace %s\n", trace_path);
+        return;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"chordgame\"}}");
+    pthread_mutex_lock(&trace_lock);
+    for (TraceRing* ring = trace_rings; ring != NULL; ring = ring->next) {
+        while (atomic_load(&ring->writing)) {
+            sched_yield();
+        }
+        unsigned long first = ring->count > TRACE_RING_EVENTS ? ring->count - TRACE_RING_EVENTS : 0;
+        for (unsigned long e = first; e < ring->count; e++) {
+            TraceEvent* event = &ring->events[e % TRACE_RING_EVENTS];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    event->name, ring->track, (event->start_ns - trace_origin_ns) / 1000.0, event->duration_ns / 1000.0);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    fprintf(file, "\n]}\n");
+    fclose(file);
 }
 
+void trace_start(const char* path) {
+    trace_path = path;
+    trace_origin_ns = trace_now_ns();
+    pthread_key_create(&trace_key, trace_release_ring);
+    atexit(trace_flush);
+}
 
+#define TRACE_BEGIN(span) uint64_t trace_##span = trace_path != NULL ? trace_now_ns() : 0
+#define TRACE_END(span, name) do { if (trace_path != NULL) trace_record(name, trace_##span); } while (0)
 
+#else
 
+#define TRACE_BEGIN(span) ((void)0)
+#define TRACE_END(span, name) ((void)0)
 
+#endif
 
+// Fixed seed for reproducible runs (-seed); otherwise seeded from the clock
+unsigned int random_seed = 0;
+int random_seed_set = 0;
 
-int is_valid_note_input(const char *input) {
+// Headless mode: a null audio sink, no Pa_Sleep, and guesses from a script or generator
+int headless = 0;
+int headless_render = 0;  // still synthesize each wavetable into the null sink
 
-    return get_pitch_class_from_note(input) != -1;
+// Print timing diagnostics (-timing)
+int report_timing = 0;
 
+double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
 }
 
+// Sleep between UI steps; skipped entirely in headless mode
+void game_sleep(long milliseconds) {
+    if (!headless) {
+        TRACE_BEGIN(sleep);
+        Pa_Sleep(milliseconds);
+        TRACE_END(sleep, "sleep");
+    }
+}
 
+// Function to print the generated notes
 
+void print_generated_scale(Note* generated_scale, int num_notes) {
 
+    for (int i = 0; i < num_notes; i++) {
 
-double C0_frequency = 16.352;
-
-int major_scale_intervals[7] = {2, 2, 1, 2, 2, 2, 1};
-
-
-
-typedef struct {
-
-    char name[3];
-
-    int pitch_class;
+        printf(" Note: %-10s | Octave: %d | Frequency: %.2f Hz\n",
 
-    int octave;
+                generated_scale[i].name,
 
-    double frequency;
+               generated_scale[i].octave, generated_scale[i].frequency);
 
-    const char* enharmonic_equiv;
+    }
 
-} Note;
+}
 
 
 
+// --- Real-time audio thread ---
+// -rt locks synthesis memory, pre-faults buffers before each stream starts and asks for
+// SCHED_FIFO on the callback thread. Denormals are flushed to zero on every callback
+// thread. Building with -DCHORDGAME_RT_DEBUG aborts on malloc or mutex use in a callback.
 
+#define RT_PRIORITY 70
 
+int rt_mode = 0;
+int rt_memory_locked = 0;             // 1 = mlockall succeeded, otherwise buffers are locked one by one
+atomic_int rt_priority_status = 0;    // 0 = not attempted, 1 = granted, otherwise -errno
+int rt_priority_probe = 0;            // rt_priority_status of the probe thread at setup
+static __thread int rt_thread_prepared = 0;
 
+#ifdef CHORDGAME_RT_DEBUG
+static __thread int in_audio_callback = 0;
 
-// Convert note name to lowercase, but preserve sharps
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+static int (*next_pthread_mutex_lock)(pthread_mutex_t*) = NULL;
 
-void normalize_note_name_for_enharmonic(const char* input, char* output) {
+__attribute__((constructor)) static void rt_debug_init(void) {
+    next_pthread_mutex_lock = (int (*)(pthread_mutex_t*))dlsym(RTLD_NEXT, "pthread_mutex_lock");
+}
 
-    int len = strlen(input);
+static void rt_violation(const char* what) {
+    // stderr is sent to /dev/null, so report on stdout
+    static const char prefix[] = "\nRT violation inside audio callback: ";
+    if (write(STDOUT_FILENO, prefix, sizeof(prefix) - 1) < 0 || write(STDOUT_FILENO, what, strlen(what)) < 0) {
+        // nothing more we can do
+    }
+    abort();
+}
 
-    for (int i = 0; i < len; i++) {
+void* malloc(size_t size) {
+    if (in_audio_callback) {
+        rt_violation("malloc\n");
+    }
+    return __libc_malloc(size);
+}
 
-        if (input[i] != '#') {
+void* calloc(size_t count, size_t size) {
+    if (in_audio_callback) {
+        rt_violation("calloc\n");
+    }
+    return __libc_calloc(count, size);
+}
 
-            output[i] = tolower((unsigned char)input[i]);
+void* realloc(void* ptr, size_t size) {
+    if (in_audio_callback) {
+        rt_violation("realloc\n");
+    }
+    return __libc_realloc(ptr, size);
+}
 
-        } else {
+void free(void* ptr) {
+    if (in_audio_callback && ptr != NULL) {
+        rt_violation("free\n");
+    }
+    __libc_free(ptr);
+}
 
-            output[i] = input[i];
+int pthread_mutex_lock(pthread_mutex_t* mutex) {
+    if (in_audio_callback) {
+        rt_violation("pthread_mutex_lock\n");
+    }
+    return next_pthread_mutex_lock(mutex);
+}
 
-        }
+#define RT_CALLBACK_ENTER() (in_audio_callback = 1)
+#define RT_CALLBACK_EXIT() (in_audio_callback = 0)
+#else
+#define RT_CALLBACK_ENTER() ((void)0)
+#define RT_CALLBACK_EXIT() ((void)0)
+#endif
+
+// Set flush-to-zero and denormals-are-zero for the calling thread
+void enable_flush_denormals(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#elif defined(__aarch64__)
+    unsigned long fpcr;
+    __asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ volatile("msr fpcr, %0" : : "r"(fpcr | (1UL << 24)));
+#endif
+}
 
+// Runs once per callback thread, on its first callback
+static inline void rt_prepare_callback_thread(void) {
+    if (rt_thread_prepared) {
+        return;
     }
+    rt_thread_prepared = 1;
+    enable_flush_denormals();
+    if (rt_mode) {
+        struct sched_param param = { .sched_priority = RT_PRIORITY };
+        int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        atomic_store(&rt_priority_status, result == 0 ? 1 : -result);
+    }
+}
 
-    output[len] = '\0';
-
+// Lock all current and future memory, falling back to per-buffer locking
+void rt_lock_all_memory(void) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+        rt_memory_locked = 1;
+        printf("RT: memory locked\n");
+    } else {
+        printf("Warning: mlockall failed (%s); locking audio buffers individually\n", strerror(errno));
+    }
 }
 
+void rt_lock_buffer(const void* buffer, size_t size) {
+    if (rt_mode && !rt_memory_locked) {
+        mlock(buffer, size);
+    }
+}
 
+// Touch every page so the callback never takes a page fault
+void rt_prefault(const void* buffer, size_t size) {
+    if (!rt_mode || size == 0) {
+        return;
+    }
+    const volatile char* bytes = (const volatile char*)buffer;
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < size; offset += page) {
+        (void)bytes[offset];
+    }
+    (void)bytes[size - 1];
+}
 
-// Function to compare note names (case-insensitive but preserve sharps)
+static void* rt_priority_probe_thread(void* arg) {
+    struct sched_param param = { .sched_priority = RT_PRIORITY };
+    int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    *(int*)arg = result == 0 ? 1 : -result;
+    return NULL;
+}
 
-int compare_note_names(const char* note1, const char* note2) {
+// Lock memory and report what real-time support there is before any stream opens. The
+// callback thread belongs to the audio host, so SCHED_FIFO is tried on a probe thread.
+void rt_setup(void) {
+    rt_lock_all_memory();
+    pthread_t probe;
+    if (pthread_create(&probe, NULL, rt_priority_probe_thread, &rt_priority_probe) == 0) {
+        pthread_join(probe, NULL);
+    }
+    if (rt_priority_probe != 0) {
+        printf("RT: SCHED_FIFO priority %d %s%s\n", RT_PRIORITY, rt_priority_probe == 1 ? "available" : "denied: ",
+               rt_priority_probe == 1 ? "" : strerror(-rt_priority_probe));
+    }
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+    printf("RT: denormals flushed to zero on audio threads\n");
+#else
+    printf("RT: denormals are not flushed on this CPU\n");
+#endif
+}
 
-    char normalized_note1[3], normalized_note2[3];
+// Report the callback thread's SCHED_FIFO result once, if it differs from the probe's
+void rt_report_status(void) {
+    static int reported = 0;
+    int status = atomic_load(&rt_priority_status);
+    if (!rt_mode || reported || status == 0) {
+        return;
+    }
+    reported = 1;
+    if (status != rt_priority_probe) {
+        printf("RT: SCHED_FIFO priority %d %s%s on the audio thread\n", RT_PRIORITY,
+               status == 1 ? "granted" : "denied: ", status == 1 ? "" : strerror(-status));
+    }
+}
 
-    normalize_note_name(note1, normalized_note1);
+// --- FFT ---
+// Iterative radix-2 complex FFT with precomputed bit reversal and twiddles.
 
-    normalize_note_name(note2, normalized_note2);
+typedef struct {
+    float re;
+    float im;
+} Complex;
 
-    return strcmp(normalized_note1, normalized_note2) == 0;
+typedef struct {
+    int size;
+    int* bit_reverse;
+    Complex* twiddles;  // e^(-2*pi*i*k/size) for k < size/2
+} FftPlan;
+
+int fft_plan_init(FftPlan* plan, int size) {
+    plan->size = size;
+    plan->bit_reverse = malloc(sizeof(int) * size);
+    plan->twiddles = malloc(sizeof(Complex) * (size / 2));
+    if (plan->bit_reverse == NULL || plan->twiddles == NULL) {
+        free(plan->bit_reverse);
+        free(plan->twiddles);
+        return 0;
+    }
+    int bits = 0;
+    while ((1 << bits) < size) {
+        bits++;
+    }
+    for (int i = 0; i < size; i++) {
+        int reversed = 0;
+        for (int b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        plan->bit_reverse[i] = reversed;
+    }
+    for (int k = 0; k < size / 2; k++) {
+        plan->twiddles[k].re = (float)cos(-2.0 * M_PI * k / size);
+        plan->twiddles[k].im = (float)sin(-2.0 * M_PI * k / size);
+    }
+    return 1;
+}
 
+void fft_plan_destroy(FftPlan* plan) {
+    free(plan->bit_reverse);
+    free(plan->twiddles);
 }
 
+// In-place transform; the inverse is unscaled
+void fft_execute(const FftPlan* plan, Complex* data, int inverse) {
+    int n = plan->size;
+    for (int i = 0; i < n; i++) {
+        int j = plan->bit_reverse[i];
+        if (j > i) {
+            Complex temp = data[i];
+            data[i] = data[j];
+            data[j] = temp;
+        }
+    }
+    for (int half = 1; half < n; half *= 2) {
+        int stride = n / (2 * half);
+        for (int start = 0; start < n; start += 2 * half) {
+            for (int k = 0; k < half; k++) {
+                Complex w = plan->twiddles[k * stride];
+                if (inverse) {
+                    w.im = -w.im;
+                }
+                Complex* a = &data[start + k];
+                Complex* b = &data[start + k + half];
+                float re = b->re * w.re - b->im * w.im;
+                float im = b->re * w.im + b->im * w.re;
+                b->re = a->re - re;
+                b->im = a->im - im;
+                a->re += re;
+                a->im += im;
+            }
+        }
+    }
+}
 
+// --- Audio tap ---
+// Callbacks copy their output into this single-producer ring so analysis can run on
+// another thread. Nothing here blocks the audio thread.
 
-// Get the note number based on pitch class and octave
+#define TAP_SIZE 16384  // power of two
 
-int get_note_number(int pitch_class, int octave) {
+typedef struct {
+    float samples[TAP_SIZE];
+    atomic_ulong write_position;
+    atomic_int enabled;
+} AudioTap;
 
-    return (octave + 1) * 12 + pitch_class;  // Shift octave correctly
+AudioTap audio_tap;
 
+static inline void audio_tap_write(const float* samples, unsigned long frames) {
+    if (!atomic_load_explicit(&audio_tap.enabled, memory_order_relaxed)) {
+        return;
+    }
+    unsigned long position = atomic_load_explicit(&audio_tap.write_position, memory_order_relaxed);
+    for (unsigned long i = 0; i < frames; i++) {
+        audio_tap.samples[(position + i) & (TAP_SIZE - 1)] = samples[i];
+    }
+    atomic_store_explicit(&audio_tap.write_position, position + frames, memory_order_release);
 }
 
+// Copy the most recent 'frames' samples (frames <= TAP_SIZE)
+void audio_tap_read_latest(float* out, int frames) {
+    unsigned long end = atomic_load_explicit(&audio_tap.write_position, memory_order_acquire);
+    for (int i = 0; i < frames; i++) {
+        out[i] = audio_tap.samples[(end - frames + i) & (TAP_SIZE - 1)];
+    }
+}
 
+// --- Convolution reverb ---
+// Impulse-response reverb on the output bus using uniformly partitioned overlap-save
+// convolution. The IR is cut into REVERB_BLOCK partitions whose spectra are multiplied
+// against a frequency-domain delay line of past input blocks, so every block costs the
+// same regardless of where the IR energy lies. The dry signal is not delayed; the wet
+// signal lags by exactly one block.
 
-// Get the frequency of the note based on pitch class and octave
-
-double get_frequency(int pitch_class, int octave) {
-
-    int note_number = get_note_number(pitch_class, octave);
-
-    return C0_frequency * pow(2.0, (double)note_number / 12.0);
+#define REVERB_BLOCK 512
+#define REVERB_FFT_SIZE (2 * REVERB_BLOCK)
+#define REVERB_BINS (REVERB_BLOCK + 1)
+#define REVERB_MAX_SECONDS 10
 
+typedef struct {
+    int enabled;
+    int partitions;
+    float mix;                   // 0 = dry only, 1 = wet only
+    FftPlan plan;
+    Complex* ir_spectra;         // partitions * REVERB_BINS; read-only when mapped from the table cache
+    Complex* delay_line;         // partitions * REVERB_BINS, spectra of past input blocks
+    int delay_head;
+    float history[REVERB_FFT_SIZE];  // previous and current input block
+    Complex work[REVERB_FFT_SIZE];
+    Complex accumulator[REVERB_BINS];
+    float input_block[REVERB_BLOCK];
+    float wet_block[REVERB_BLOCK];   // wet output of the previous block, played during this one
+    int fill;
+} Reverb;
+
+Reverb reverb;
+
+static uint16_t read_le16(const unsigned char* bytes) {
+    return bytes[0] | (bytes[1] << 8);
 }
 
+static uint32_t read_le32(const unsigned char* bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
 
+// Load a PCM (16/24/32-bit) or float WAV file as mono at SAMPLE_RATE. Returns the number
+// of frames, or 0 on error; the caller frees *samples.
+int load_wav_mono(const char* path, float** samples) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("Error: Could not open %s\n", path);
+        return 0;
+    }
+    unsigned char header[12], chunk[8], format[16];
+    int channels = 0, bits = 0, format_tag = 0, have_format = 0;
+    long rate = 0;
+    uint32_t data_size = 0;
+    unsigned char* data = NULL;
+
+    if (fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        printf("Error: %s is not a WAV file\n", path);
+        fclose(file);
+        return 0;
+    }
+    while (data == NULL && fread(chunk, 1, 8, file) == 8) {
+        uint32_t size = read_le32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && fread(format, 1, 16, file) == 16) {
+            format_tag = read_le16(format);
+            channels = read_le16(format + 2);
+            rate = read_le32(format + 4);
+            bits = read_le16(format + 14);
+            have_format = 1;
+            fseek(file, size - 16 + (size & 1), SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0 && have_format) {
+            data_size = size;
+            data = malloc(size);
+            if (data == NULL || fread(data, 1, size, file) != size) {
+                free(data);
+                data = NULL;
+                break;
+            }
+        } else {
+            fseek(file, size + (size & 1), SEEK_CUR);
+        }
+    }
+    fclose(file);
 
-// Function to generate the major scale for a specific root note
-
-void generate_major_scale(const char* root_note, Note* notes, int* num_notes, int range_low, int range_high, int allowed_pitch_classes[]) {
-
-    int root_pitch_class = -1;
+    if (format_tag == 0xFFFE) {
+        format_tag = bits == 32 ? 3 : 1;  // WAVE_FORMAT_EXTENSIBLE: assume the common subtypes
+    }
+    int bytes_per_sample = bits / 8;
+    if (data == NULL || channels < 1 || rate <= 0 ||
+        !((format_tag == 1 && (bits == 16 || bits == 24 || bits == 32)) || (format_tag == 3 && bits == 32))) {
+        printf("Error: %s must be 16/24/32-bit PCM or 32-bit float\n", path);
+        free(data);
+        return 0;
+    }
 
-    for (int i = 0; i < NUM_NOTES; i++) {
+    int source_frames = data_size / (bytes_per_sample * channels);
+    float* mono = malloc(sizeof(float) * (source_frames + 1));
+    if (mono == NULL) {
+        free(data);
+        return 0;
+    }
+    for (int f = 0; f < source_frames; f++) {
+        float sum = 0.0f;
+        for (int c = 0; c < channels; c++) {
+            const unsigned char* sample = data + ((size_t)f * channels + c) * bytes_per_sample;
+            if (format_tag == 3) {
+                float value;
+                memcpy(&value, sample, sizeof(value));
+                sum += value;
+            } else if (bits == 16) {
+                sum += (int16_t)read_le16(sample) / 32768.0f;
+            } else if (bits == 24) {
+                int32_t value = (int32_t)((uint32_t)sample[0] << 8 | (uint32_t)sample[1] << 16 | (uint32_t)sample[2] << 24);
+                sum += value / 2147483648.0f;
+            } else {
+                sum += (int32_t)read_le32(sample) / 2147483648.0f;
+            }
+        }
+        mono[f] = sum / channels;
+    }
+    mono[source_frames] = 0.0f;
+    free(data);
 
-        if (strcmp(root_note, note_names[i]) == 0 || strcmp(root_note, enharmonic_equivalents[i]) == 0) {
+    if (rate == SAMPLE_RATE) {
+        *samples = mono;
+        return source_frames;
+    }
+    // Linear resampling is adequate for a reverb tail
+    int frames = (int)((double)source_frames * SAMPLE_RATE / rate);
+    float* resampled = malloc(sizeof(float) * (frames > 0 ? frames : 1));
+    if (resampled == NULL) {
+        free(mono);
+        return 0;
+    }
+    for (int f = 0; f < frames; f++) {
+        double position = (double)f * rate / SAMPLE_RATE;
+        int index = (int)position;
+        double fraction = position - index;
+        resampled[f] = (float)(mono[index] * (1.0 - fraction) + mono[index + 1] * fraction);
+    }
+    free(mono);
+    *samples = resampled;
+    return frames;
+}
 
-            root_pitch_class = i;
+// Partition an impulse response and precompute the spectrum of each partition
+int reverb_init(Reverb* rv, const float* ir, int ir_frames, float mix) {
+    memset(rv, 0, sizeof(*rv));
+    if (ir_frames > REVERB_MAX_SECONDS * SAMPLE_RATE) {
+        ir_frames = REVERB_MAX_SECONDS * SAMPLE_RATE;
+    }
+    rv->partitions = (ir_frames + REVERB_BLOCK - 1) / REVERB_BLOCK;
+    rv->mix = mix;
+    rv->ir_spectra = calloc((size_t)rv->partitions * REVERB_BINS, sizeof(Complex));
+    rv->delay_line = calloc((size_t)rv->partitions * REVERB_BINS, sizeof(Complex));
+    if (rv->partitions == 0 || rv->ir_spectra == NULL || rv->delay_line == NULL || !fft_plan_init(&rv->plan, REVERB_FFT_SIZE)) {
+        printf("Error: Could not set up the reverb\n");
+        free(rv->ir_spectra);
+        free(rv->delay_line);
+        return 0;
+    }
 
-            break;
+    // Normalise the IR to unit energy so the wet level does not depend on the recording
+    double energy = 0.0;
+    for (int i = 0; i < ir_frames; i++) {
+        energy += (double)ir[i] * ir[i];
+    }
+    float scale = energy > 0.0 ? (float)(1.0 / sqrt(energy)) : 0.0f;
 
+    for (int p = 0; p < rv->partitions; p++) {
+        for (int i = 0; i < REVERB_FFT_SIZE; i++) {
+            int source = p * REVERB_BLOCK + i;
+            rv->work[i].re = i < REVERB_BLOCK && source < ir_frames ? ir[source] * scale : 0.0f;
+            rv->work[i].im = 0.0f;
         }
-
+        fft_execute(&rv->plan, rv->work, 0);
+        memcpy(&rv->ir_spectra[(size_t)p * REVERB_BINS], rv->work, sizeof(Complex) * REVERB_BINS);
     }
+    rt_lock_buffer(rv->ir_spectra, sizeof(Complex) * rv->partitions * REVERB_BINS);
+    rt_lock_buffer(rv->delay_line, sizeof(Complex) * rv->partitions * REVERB_BINS);
+    rv->enabled = 1;
+    return 1;
+}
 
-    if (root_pitch_class == -1) {
+int reverb_load(Reverb* rv, const char* path, float mix) {
+    float* ir = NULL;
+    int frames = load_wav_mono(path, &ir);
+    if (frames == 0) {
+        return 0;
+    }
+    int ok = reverb_init(rv, ir, frames, mix);
+    free(ir);
+    return ok;
+}
 
-        printf("Error: Invalid root note %s\n", root_note);
+// Set up the reverb around IR spectra computed by an earlier run (see the table cache).
+// The spectra are only read, so they can live in a read-only mapping.
+int reverb_init_from_spectra(Reverb* rv, const Complex* spectra, int partitions, float mix) {
+    memset(rv, 0, sizeof(*rv));
+    rv->partitions = partitions;
+    rv->mix = mix;
+    rv->ir_spectra = (Complex*)spectra;
+    rv->delay_line = calloc((size_t)partitions * REVERB_BINS, sizeof(Complex));
+    if (partitions == 0 || rv->delay_line == NULL || !fft_plan_init(&rv->plan, REVERB_FFT_SIZE)) {
+        printf("Error: Could not set up the reverb\n");
+        free(rv->delay_line);
+        return 0;
+    }
+    rt_lock_buffer(rv->ir_spectra, sizeof(Complex) * partitions * REVERB_BINS);
+    rt_lock_buffer(rv->delay_line, sizeof(Complex) * partitions * REVERB_BINS);
+    rv->enabled = 1;
+    return 1;
+}
 
+// Clear the reverb state between streams (not called from the callback)
+void reverb_reset(Reverb* rv) {
+    if (!rv->enabled) {
         return;
-
     }
+    memset(rv->delay_line, 0, sizeof(Complex) * rv->partitions * REVERB_BINS);
+    memset(rv->history, 0, sizeof(rv->history));
+    memset(rv->wet_block, 0, sizeof(rv->wet_block));
+    rv->fill = 0;
+}
 
+// Convolve one full input block; the result is played during the next block
+static void reverb_process_block(Reverb* rv) {
+    memmove(rv->history, rv->history + REVERB_BLOCK, sizeof(float) * REVERB_BLOCK);
+    memcpy(rv->history + REVERB_BLOCK, rv->input_block, sizeof(float) * REVERB_BLOCK);
+    for (int i = 0; i < REVERB_FFT_SIZE; i++) {
+        rv->work[i].re = rv->history[i];
+        rv->work[i].im = 0.0f;
+    }
+    fft_execute(&rv->plan, rv->work, 0);
+
+    rv->delay_head = rv->delay_head == 0 ? rv->partitions - 1 : rv->delay_head - 1;
+    memcpy(&rv->delay_line[(size_t)rv->delay_head * REVERB_BINS], rv->work, sizeof(Complex) * REVERB_BINS);
+
+    // Multiply-accumulate every partition against the matching past input block
+    memset(rv->accumulator, 0, sizeof(rv->accumulator));
+    for (int p = 0; p < rv->partitions; p++) {
+        int slot = rv->delay_head + p;
+        slot -= slot >= rv->partitions ? rv->partitions : 0;
+        const Complex* x = &rv->delay_line[(size_t)slot * REVERB_BINS];
+        const Complex* h = &rv->ir_spectra[(size_t)p * REVERB_BINS];
+        for (int k = 0; k < REVERB_BINS; k++) {
+            rv->accumulator[k].re += x[k].re * h[k].re - x[k].im * h[k].im;
+            rv->accumulator[k].im += x[k].re * h[k].im + x[k].im * h[k].re;
+        }
+    }
 
+    // Rebuild the conjugate-symmetric spectrum and keep the last block (overlap-save)
+    for (int k = 0; k < REVERB_BINS; k++) {
+        rv->work[k] = rv->accumulator[k];
+    }
+    for (int k = 1; k < REVERB_BLOCK; k++) {
+        rv->work[REVERB_FFT_SIZE - k].re = rv->accumulator[k].re;
+        rv->work[REVERB_FFT_SIZE - k].im = -rv->accumulator[k].im;
+    }
+    fft_execute(&rv->plan, rv->work, 1);
+    for (int i = 0; i < REVERB_BLOCK; i++) {
+        rv->wet_block[i] = rv->work[REVERB_BLOCK + i].re / REVERB_FFT_SIZE;
+    }
+}
 
-    //printf("Generating major scale from root note: %s (%d)\n", root_note, root_pitch_class);
-
-    //printf("Octave range: %d to %d\n", range_low, range_high);
-
-
-
-    int current_pitch_class = root_pitch_class;
+// Mix the reverb into a block of output in place
+static inline void reverb_process(Reverb* rv, float* samples, unsigned long frames) {
+    if (!rv->enabled) {
+        return;
+    }
+    for (unsigned long i = 0; i < frames; i++) {
+        float dry = samples[i];
+        rv->input_block[rv->fill] = dry;
+        samples[i] = (1.0f - rv->mix) * dry + rv->mix * rv->wet_block[rv->fill];
+        if (++rv->fill == REVERB_BLOCK) {
+            reverb_process_block(rv);
+            rv->fill = 0;
+        }
+    }
+}
 
+// --- Output limiter ---
+// Look-ahead peak limiter at the end of the output bus, so chords can be mixed louder
+// than 1/num_notes without clipping. Output is delayed by two LIMITER_BLOCKs. When a
+// block is complete its peak is known, so the gain ramp for the block before it can end
+// at or below what both need, and no sample ever exceeds LIMITER_CEILING. Attack is
+// one block and release is one pole step per block, so the work per block is one peak
+// scan and one gain ramp (SSE on x86) however loud the input is.
 
+#define LIMITER_BLOCK 32            // multiple of 4
+#define LIMITER_LATENCY_FRAMES (2 * LIMITER_BLOCK)
+#define LIMITER_CEILING 0.891f      // -1 dBFS
+#define LIMITER_RELEASE 0.02f       // fraction of the way back to unity per block, about 33 ms
 
-    for (int octave = range_low; octave <= range_high; octave++) {
+typedef struct {
+    float input_block[LIMITER_BLOCK];    // being filled from the bus
+    float pending_block[LIMITER_BLOCK];  // complete, peak known, played next
+    float output_block[LIMITER_BLOCK];   // being played
+    float pending_gain;                  // gain pending_block needs to stay under the ceiling
+    float gain;                          // gain at the start of output_block
+    float gain_end;                      // gain at its end
+    float gain_step;
+    int fill;
+} Limiter;
+
+Limiter limiter = { .pending_gain = 1.0f, .gain = 1.0f, .gain_end = 1.0f };
+
+void limiter_reset(Limiter* lim) {
+    memset(lim, 0, sizeof(*lim));
+    lim->pending_gain = 1.0f;
+    lim->gain = 1.0f;
+    lim->gain_end = 1.0f;
+}
 
-        current_pitch_class = root_pitch_class;  // reset for each octave
+static inline float limiter_block_peak(const float* block) {
+#if defined(__x86_64__) || defined(__i386__)
+    const __m128 sign_bit = _mm_set1_ps(-0.0f);
+    __m128 peak = _mm_setzero_ps();
+    for (int i = 0; i < LIMITER_BLOCK; i += 4) {
+        peak = _mm_max_ps(peak, _mm_andnot_ps(sign_bit, _mm_loadu_ps(block + i)));
+    }
+    peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+    return _mm_cvtss_f32(peak);
+#else
+    float peak = 0.0f;
+    for (int i = 0; i < LIMITER_BLOCK; i++) {
+        float magnitude = fabsf(block[i]);
+        peak = magnitude > peak ? magnitude : peak;
+    }
+    return peak;
+#endif
+}
 
-        for (int i = 0; i < 7; i++) {
+// Write out[i] = block[i] * (start + step * (i + 1)) for n samples
+static inline void limiter_apply_ramp(const float* block, float* out, int n, float start, float step) {
+    int i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    __m128 gain = _mm_setr_ps(start + step, start + 2.0f * step, start + 3.0f * step, start + 4.0f * step);
+    const __m128 advance = _mm_set1_ps(4.0f * step);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(block + i), gain));
+        gain = _mm_add_ps(gain, advance);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = block[i] * (start + step * (i + 1));
+    }
+}
 
-            if (*num_notes >= MAX_SCALE_LENGTH) {
+// A block has been collected: shift the blocks along and plan the gain ramp
+static void limiter_next_block(Limiter* lim) {
+    // The ramp for the block about to play starts where the last one ended, which is
+    // already at or below its need, and ends at or below the need of the block after it
+    float need = lim->pending_gain;
+    lim->gain = lim->gain_end;
+    memcpy(lim->output_block, lim->pending_block, sizeof(lim->output_block));
+    memcpy(lim->pending_block, lim->input_block, sizeof(lim->pending_block));
+    float peak = limiter_block_peak(lim->pending_block);
+    lim->pending_gain = peak > LIMITER_CEILING ? LIMITER_CEILING / peak : 1.0f;
+
+    float target = lim->gain + (1.0f - lim->gain) * LIMITER_RELEASE;
+    target = need < target ? need : target;
+    target = lim->pending_gain < target ? lim->pending_gain : target;
+    lim->gain_end = target;
+    lim->gain_step = (target - lim->gain) / LIMITER_BLOCK;
+    lim->fill = 0;
+}
 
-                //printf("Reached max scale length.\n");
+static inline void limiter_process(Limiter* lim, float* samples, unsigned long frames) {
+    unsigned long done = 0;
+    while (done < frames) {
+        int n = LIMITER_BLOCK - lim->fill;
+        n = (unsigned long)n > frames - done ? (int)(frames - done) : n;
+        memcpy(lim->input_block + lim->fill, samples + done, sizeof(float) * n);
+        limiter_apply_ramp(lim->output_block + lim->fill, samples + done, n,
+                           lim->gain + lim->gain_step * lim->fill, lim->gain_step);
+        lim->fill += n;
+        done += n;
+        if (lim->fill == LIMITER_BLOCK) {
+            limiter_next_block(lim);
+        }
+    }
+}
 
-                return;
+// --- Output bus ---
+// Everything a callback writes passes through here before it reaches the device.
 
-            }
+static inline void output_bus_process(float* samples, unsigned long frames) {
+    reverb_process(&reverb, samples, frames);
+    limiter_process(&limiter, samples, frames);
+    audio_tap_write(samples, frames);
+}
 
+// --- Synthesis table cache ---
+// The tuning and loudness tables and the reverb IR spectra are written to a cache file
+// named after a hash of everything they are built from, and later runs map that file
+// read-only instead of rebuilding them. The mapping is MAP_SHARED, so processes using the
+// same configuration share one copy in the page cache. Files are written under a
+// temporary name and renamed into place, so a reader never sees a partial file, and a
+// file with the wrong magic, version, key, size or checksum is rebuilt.
 
+#define TABLE_CACHE_MAGIC "CGTABLES"
+#define TABLE_CACHE_VERSION 2
+#define TABLE_CACHE_ALIGN 64
 
-            if (allowed_pitch_classes[current_pitch_class]) {
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t config_hash;
+    uint64_t file_size;
+    uint64_t checksum;           // of everything after the header
+    uint64_t tuning_offset;      // Tuning
+    uint64_t loudness_offset;    // double[NUM_OCTAVES][NUM_NOTES]
+    uint64_t reverb_offset;      // Complex[reverb_partitions * REVERB_BINS], 0 if no reverb
+    uint32_t reverb_partitions;
+    uint32_t reserved;
+} TableCacheHeader;
 
-                double freq = get_frequency(current_pitch_class, octave);
+typedef struct {
+    char path[1024];
+    uint64_t config_hash;
+    const unsigned char* map;    // NULL until a valid file is mapped
+    size_t map_size;
+} TableCache;
+
+TableCache table_cache;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
 
-                /*printf("  Adding note %s (oct %d) | pitch_class: %d | freq: %.2f\n",
+// FNV-1a over 64-bit words, so checking a few MB of spectra stays well under a millisecond
+static uint64_t table_cache_checksum(const unsigned char* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t words = size / sizeof(uint64_t);
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, data + i * sizeof(uint64_t), sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    return fnv1a(hash, data + words * sizeof(uint64_t), size % sizeof(uint64_t));
+}
 
-                       note_names[current_pitch_class], octave, current_pitch_class, freq); */
+// Files are identified by path, size and modification time rather than by reading them
+static uint64_t hash_file_identity(uint64_t hash, const char* path) {
+    struct stat info;
+    hash = fnv1a(hash, path, strlen(path) + 1);
+    if (stat(path, &info) == 0) {
+        int64_t identity[3] = {(int64_t)info.st_size, (int64_t)info.st_mtim.tv_sec, (int64_t)info.st_mtim.tv_nsec};
+        hash = fnv1a(hash, identity, sizeof(identity));
+    }
+    return hash;
+}
 
+// Hash of every input and layout constant the cached tables depend on
+uint64_t table_cache_key(const char* tuning_spec, int tuning_root, const char* reverb_path) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int32_t layout[] = {TABLE_CACHE_VERSION, (int32_t)sizeof(Tuning), (int32_t)sizeof(Complex), NUM_OCTAVES,
+                        SAMPLE_RATE, REVERB_BLOCK, REVERB_MAX_SECONDS, tuning_root};
+    hash = fnv1a(hash, layout, sizeof(layout));
+    hash = fnv1a(hash, &a4_frequency, sizeof(a4_frequency));
+    hash = fnv1a(hash, &loudness_phon, sizeof(loudness_phon));
+    size_t len = strlen(tuning_spec);
+    if (len > 4 && strcmp(tuning_spec + len - 4, ".scl") == 0) {
+        hash = hash_file_identity(hash, tuning_spec);
+    } else {
+        hash = fnv1a(hash, tuning_spec, len + 1);
+    }
+    if (reverb_path != NULL) {
+        hash = hash_file_identity(hash, reverb_path);
+    }
+    return hash;
+}
 
+// Cache directory: $XDG_CACHE_HOME/chordgame, else ~/.cache/chordgame; NULL if neither is set
+const char* table_cache_default_dir(void) {
+    static char directory[768];
+    const char* base = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (base != NULL && base[0] != '\0') {
+        snprintf(directory, sizeof(directory), "%s/chordgame", base);
+    } else if (home != NULL && home[0] != '\0') {
+        snprintf(directory, sizeof(directory), "%s/.cache/chordgame", home);
+    } else {
+        return NULL;
+    }
+    return directory;
+}
 
-                notes[*num_notes] = (Note){
+// 1 if an aligned region of size bytes at offset lies after the header and inside the file.
+// Offsets come from the file, so the bound is written to hold even when offset + size would wrap.
+static int table_cache_region_valid(uint64_t offset, uint64_t size, uint64_t file_size) {
+    return offset >= sizeof(TableCacheHeader) && offset % TABLE_CACHE_ALIGN == 0
+           && offset <= file_size && size <= file_size - offset;
+}
 
-                    .pitch_class = current_pitch_class,
+static int table_cache_valid(const TableCache* cache) {
+    if (cache->map_size < sizeof(TableCacheHeader)) {
+        return 0;
+    }
+    const TableCacheHeader* header = (const TableCacheHeader*)cache->map;
+    uint64_t reverb_bytes = (uint64_t)header->reverb_partitions * REVERB_BINS * sizeof(Complex);
+    return memcmp(header->magic, TABLE_CACHE_MAGIC, sizeof(header->magic)) == 0
+           && header->version == TABLE_CACHE_VERSION
+           && header->header_size == sizeof(TableCacheHeader)
+           && header->config_hash == cache->config_hash
+           && header->file_size == cache->map_size
+           && table_cache_region_valid(header->tuning_offset, sizeof(Tuning), cache->map_size)
+           && table_cache_region_valid(header->loudness_offset, sizeof(loudness_table), cache->map_size)
+           && (header->reverb_offset == 0 || table_cache_region_valid(header->reverb_offset, reverb_bytes, cache->map_size))
+           && header->checksum == table_cache_checksum(cache->map + sizeof(TableCacheHeader),
+                                                       cache->map_size - sizeof(TableCacheHeader));
+}
 
-                    .octave = octave,
+// Map the cache file for this configuration and install its tuning and loudness tables.
+// Returns 0 (leaving the tables untouched) if there is no valid file.
+int table_cache_load(TableCache* cache, const char* directory, uint64_t config_hash) {
+    memset(cache, 0, sizeof(*cache));
+    cache->config_hash = config_hash;
+    snprintf(cache->path, sizeof(cache->path), "%s/tables-%016llx.bin", directory, (unsigned long long)config_hash);
 
-                    .frequency = freq,
+    int fd = open(cache->path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    struct stat info;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(TableCacheHeader)) {
+        map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    cache->map = (const unsigned char*)map;
+    cache->map_size = (size_t)info.st_size;
+    if (!table_cache_valid(cache)) {
+        munmap(map, cache->map_size);
+        cache->map = NULL;
+        return 0;
+    }
 
-                    .enharmonic_equiv = enharmonic_equivalents[current_pitch_class]
+    const TableCacheHeader* header = (const TableCacheHeader*)cache->map;
+    memcpy(&current_tuning, cache->map + header->tuning_offset, sizeof(Tuning));
+    memcpy(loudness_table, cache->map + header->loudness_offset, sizeof(loudness_table));
+    return 1;
+}
 
-                };
+// IR spectra inside the mapping, or NULL if the file was written without a reverb
+const Complex* table_cache_reverb_spectra(const TableCache* cache, int* partitions) {
+    if (cache->map == NULL) {
+        return NULL;
+    }
+    const TableCacheHeader* header = (const TableCacheHeader*)cache->map;
+    if (header->reverb_offset == 0) {
+        return NULL;
+    }
+    *partitions = (int)header->reverb_partitions;
+    return (const Complex*)(cache->map + header->reverb_offset);
+}
 
-                snprintf(notes[*num_notes].name, sizeof(notes[*num_notes].name), "%s", note_names[current_pitch_class]);
+static size_t table_cache_align(size_t offset) {
+    return (offset + TABLE_CACHE_ALIGN - 1) / TABLE_CACHE_ALIGN * TABLE_CACHE_ALIGN;
+}
 
-                (*num_notes)++;
+// Write the current tables for the path chosen by table_cache_load. Failure only costs
+// the next run a rebuild, so it is not reported.
+void table_cache_store(const TableCache* cache, const char* directory, const Tuning* tuning, const Reverb* rv) {
+    TableCacheHeader header = {0};
+    memcpy(header.magic, TABLE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TABLE_CACHE_VERSION;
+    header.header_size = sizeof(TableCacheHeader);
+    header.config_hash = cache->config_hash;
+    header.tuning_offset = table_cache_align(sizeof(TableCacheHeader));
+    header.loudness_offset = table_cache_align(header.tuning_offset + sizeof(Tuning));
+    size_t end = header.loudness_offset + sizeof(loudness_table);
+    size_t reverb_bytes = 0;
+    if (rv->enabled) {
+        reverb_bytes = (size_t)rv->partitions * REVERB_BINS * sizeof(Complex);
+        header.reverb_offset = table_cache_align(end);
+        header.reverb_partitions = (uint32_t)rv->partitions;
+        end = header.reverb_offset + reverb_bytes;
+    }
+    header.file_size = end;
 
-            } else {
+    unsigned char* file = calloc(1, end);
+    if (file == NULL) {
+        return;
+    }
+    memcpy(file + header.tuning_offset, tuning, sizeof(Tuning));
+    memcpy(file + header.loudness_offset, loudness_table, sizeof(loudness_table));
+    if (reverb_bytes > 0) {
+        memcpy(file + header.reverb_offset, rv->ir_spectra, reverb_bytes);
+    }
+    header.checksum = table_cache_checksum(file + sizeof(TableCacheHeader), end - sizeof(TableCacheHeader));
+    memcpy(file, &header, sizeof(header));
+
+    // Create the directory and its parent (~/.cache may not exist yet)
+    char parent[768];
+    snprintf(parent, sizeof(parent), "%s", directory);
+    char* slash = strrchr(parent, '/');
+    if (slash != NULL && slash != parent) {
+        *slash = '\0';
+        mkdir(parent, 0755);
+    }
+    mkdir(directory, 0755);
+
+    char temporary[1100];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", cache->path, (int)getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd != -1) {
+        ssize_t written = write(fd, file, end);
+        close(fd);
+        if (written != (ssize_t)end || rename(temporary, cache->path) != 0) {
+            unlink(temporary);
+        }
+    }
+    free(file);
+}
 
-                printf("  Skipping pitch class %d (%s) not in allowed set\n", current_pitch_class, note_names[current_pitch_class]);
+// --- Output latency ---
+// By default streams use 4096-frame buffers. -latency-ms picks the buffer size and
+// suggested latency from a target, reports what the device achieved and backs off to
+// larger buffers if a stream underruns. Latencies are end to end: the output limiter's
+// look-ahead is part of the target and of what is reported.
 
-            }
+#define DEFAULT_FRAMES_PER_BUFFER 4096
+#define MIN_FRAMES_PER_BUFFER 32
 
+typedef struct {
+    double target_ms;                 // 0 = default stream settings
+    unsigned long frames_per_buffer;
+    double suggested_latency;         // seconds
+    double achieved_latency;          // seconds, from Pa_GetStreamInfo plus the limiter look-ahead
+    atomic_int underruns;             // counted by the callbacks
+    int reported;
+} LatencySettings;
+
+LatencySettings latency = { .frames_per_buffer = DEFAULT_FRAMES_PER_BUFFER };
+
+double limiter_latency_ms(void) {
+    return LIMITER_LATENCY_FRAMES * 1000.0 / SAMPLE_RATE;
+}
 
+int set_latency_target(double target_ms) {
+    if (target_ms < 1.0 || target_ms > 500.0) {
+        printf("Error: Latency target must be between 1 and 500 ms\n");
+        return 0;
+    }
+    // The limiter's look-ahead and two blocks in flight fit in the target: the one
+    // rendering and the one playing
+    double device_ms = target_ms - limiter_latency_ms();
+    unsigned long device_frames = device_ms > 0.0 ? (unsigned long)(device_ms * SAMPLE_RATE / 1000.0) : 0;
+    unsigned long frames = MIN_FRAMES_PER_BUFFER;
+    while (frames * 4 <= device_frames && frames < DEFAULT_FRAMES_PER_BUFFER) {
+        frames *= 2;
+    }
+    latency.target_ms = target_ms;
+    latency.frames_per_buffer = frames;
+    latency.suggested_latency = device_ms > 0.0 ? device_ms / 1000.0 : 0.0;
+    return 1;
+}
 
-            current_pitch_class = (current_pitch_class + major_scale_intervals[i]) % NUM_NOTES;
+// Called from the callbacks; only an atomic increment
+static inline void latency_note_status(PaStreamCallbackFlags statusFlags) {
+    if (statusFlags & paOutputUnderflow) {
+        atomic_fetch_add_explicit(&latency.underruns, 1, memory_order_relaxed);
+    }
+}
 
+// Open a mono float output stream with the current latency settings
+PaError open_output_stream(PaStream** stream, PaStreamCallback* callback, void* userData) {
+    PaError error;
+    reverb_reset(&reverb);
+    limiter_reset(&limiter);
+    if (latency.target_ms <= 0.0) {
+        error = Pa_OpenDefaultStream(stream, 0, 1, paFloat32, SAMPLE_RATE, DEFAULT_FRAMES_PER_BUFFER, callback, userData);
+    } else {
+        PaStreamParameters output = {
+            .device = Pa_GetDefaultOutputDevice(),
+            .channelCount = 1,
+            .sampleFormat = paFloat32,
+            .suggestedLatency = latency.suggested_latency,
+            .hostApiSpecificStreamInfo = NULL
+        };
+        if (output.device == paNoDevice) {
+            return paInvalidDevice;
         }
-
+        error = Pa_OpenStream(stream, NULL, &output, SAMPLE_RATE, latency.frames_per_buffer, paClipOff, callback, userData);
     }
-
+    if (error == paNoError) {
+        const PaStreamInfo* info = Pa_GetStreamInfo(*stream);
+        latency.achieved_latency = (info != NULL ? info->outputLatency : 0.0) + limiter_latency_ms() / 1000.0;
+        if (latency.target_ms > 0.0 && (!latency.reported || report_timing)) {
+            printf("Latency: target %.1f ms, %lu frames per buffer, achieved %.1f ms (%.1f ms limiter look-ahead)\n",
+                   latency.target_ms, latency.frames_per_buffer, latency.achieved_latency * 1000.0, limiter_latency_ms());
+            latency.reported = 1;
+        }
+    }
+    atomic_store(&latency.underruns, 0);
+    return error;
 }
 
+// After a stream finishes: double the buffer if it underran
+void latency_adapt(void) {
+    int underruns = atomic_exchange(&latency.underruns, 0);
+    if (latency.target_ms <= 0.0 || underruns == 0 || latency.frames_per_buffer >= DEFAULT_FRAMES_PER_BUFFER) {
+        return;
+    }
+    latency.frames_per_buffer *= 2;
+    latency.suggested_latency *= 2.0;
+    latency.reported = 0;
+    printf("%d underrun(s); raising buffer to %lu frames, about %.1f ms end to end\n", underruns,
+           latency.frames_per_buffer, latency.suggested_latency * 1000.0 + limiter_latency_ms());
+}
 
+// --- Shared-memory output ---
+// -output shm:<name> replaces the PortAudio stream with the lock-free ring described in
+// chordshm.h. A producer thread runs the same stream callbacks, each one rendering
+// straight into the next free slot of the shared mapping, so an external mixer reads the
+// samples in place. Blocks are produced on the sample clock, SHM_PREFILL_SLOTS ahead of
+// when they are due; a full ring holds the producer back, and if it stays full for a
+// whole block the block is rendered to scratch and dropped so the game keeps time.
 
-void get_allowed_pitch_classes(int allowed_pitch_classes[], const char* scales[], int num_scales) {
+#define SHM_SLOT_COUNT 16
+#define SHM_PREFILL_SLOTS 2
 
-    memset(allowed_pitch_classes, 0, sizeof(int) * NUM_NOTES);
+typedef struct {
+    char name[256];
+    ChordShmHeader* ring;          // NULL when output goes to PortAudio
+    size_t map_size;
+    float* scratch;                // target for blocks dropped on overrun
+    uint64_t frames;               // stream position across all streams
+    int free_running;              // ignore the sample clock (benchmarks)
+} ShmOutput;
 
+ShmOutput shm_output;
 
+typedef struct {
+    pthread_t thread;
+    atomic_int stop;
+    atomic_int active;
+    PaStreamCallback* callback;
+    void* user_data;
+} ShmStream;
+
+static size_t shm_align(size_t size) {
+    return (size + CHORDSHM_ALIGN - 1) / CHORDSHM_ALIGN * CHORDSHM_ALIGN;
+}
 
-    for (int s = 0; s < num_scales; s++) {
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
 
-        int root_pitch_class = -1;
+// Shared (not FUTEX_PRIVATE) operations, so they pair up across processes
+static void futex_wait(_Atomic uint32_t* word, uint32_t expected, long timeout_ns) {
+    struct timespec timeout = { timeout_ns / 1000000000L, timeout_ns % 1000000000L };
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
 
-        for (int i = 0; i < NUM_NOTES; i++) {
+static void futex_wake(_Atomic uint32_t* word) {
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
 
-            if (strcmp(scales[s], note_names[i]) == 0 || strcmp(scales[s], enharmonic_equivalents[i]) == 0) {
+// Create (or take over) the shared-memory object and lay out an empty ring
+int shm_output_create(const char* name, int frames_per_slot) {
+    size_t header_size = shm_align(sizeof(ChordShmHeader));
+    size_t slot_size = shm_align(sizeof(ChordShmSlot) + sizeof(float) * frames_per_slot);
+    size_t map_size = header_size + slot_size * SHM_SLOT_COUNT;
 
-                root_pitch_class = i;
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        printf("Error: Could not create shared memory %s\n", name);
+        return 0;
+    }
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)map_size) == 0) {
+        map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    shm_output.scratch = calloc(frames_per_slot, sizeof(float));
+    if (map == MAP_FAILED || shm_output.scratch == NULL) {
+        printf("Error: Could not map shared memory %s\n", name);
+        shm_unlink(name);
+        free(shm_output.scratch);
+        return 0;
+    }
+
+    // Zeroing also faults in every page before the first block is written
+    memset(map, 0, map_size);
+    ChordShmHeader* ring = (ChordShmHeader*)map;
+    ring->version = CHORDSHM_VERSION;
+    ring->header_size = (uint32_t)header_size;
+    ring->slot_size = (uint32_t)slot_size;
+    ring->slot_count = SHM_SLOT_COUNT;
+    ring->frames_per_slot = (uint32_t)frames_per_slot;
+    ring->channels = 1;
+    ring->sample_rate = SAMPLE_RATE;
+    ring->producer_pid = (int32_t)getpid();
+    atomic_thread_fence(memory_order_release);
+    ring->magic = CHORDSHM_MAGIC;  // consumers only trust the layout once this is set
+
+    snprintf(shm_output.name, sizeof(shm_output.name), "%s", name);
+    shm_output.ring = ring;
+    shm_output.map_size = map_size;
+    shm_output.frames = 0;
+    rt_lock_buffer(map, map_size);
+    return 1;
+}
+
+// Tell the consumer the producer is gone and remove the object
+void shm_output_destroy(void) {
+    if (shm_output.ring == NULL) {
+        return;
+    }
+    atomic_store(&shm_output.ring->producer_pid, 0);
+    futex_wake(&shm_output.ring->write_index);
+    munmap(shm_output.ring, shm_output.map_size);
+    shm_unlink(shm_output.name);
+    free(shm_output.scratch);
+    shm_output.ring = NULL;
+}
+
+// The next free slot, waiting up to timeout_ns for the consumer; NULL if it stayed full
+static ChordShmSlot* shm_ring_acquire(ChordShmHeader* ring, long timeout_ns) {
+    uint32_t write = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    uint64_t deadline = monotonic_ns() + timeout_ns;
+    for (;;) {
+        uint32_t read = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+        if (write - read < ring->slot_count) {
+            return chordshm_slot(ring, write);
+        }
+        uint64_t now = monotonic_ns();
+        if (now >= deadline) {
+            return NULL;
+        }
+        atomic_store(&ring->producer_waiting, 1);
+        if (atomic_load(&ring->read_index) == read) {
+            futex_wait(&ring->read_index, read, (long)(deadline - now));
+        }
+        atomic_store(&ring->producer_waiting, 0);
+    }
+}
+
+static void shm_ring_publish(ChordShmHeader* ring) {
+    atomic_fetch_add(&ring->write_index, 1);
+    if (atomic_load(&ring->consumer_waiting)) {
+        futex_wake(&ring->write_index);
+    }
+}
+
+static int shm_block_is_silent(const float* samples, unsigned long frames) {
+    for (unsigned long i = 0; i < frames; i++) {
+        if (samples[i] != 0.0f) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void* shm_stream_thread(void* arg) {
+    ShmStream* stream = (ShmStream*)arg;
+    ChordShmHeader* ring = shm_output.ring;
+    unsigned long frames = ring->frames_per_slot;
+    long block_ns = (long)(frames * 1000000000ULL / SAMPLE_RATE);
+    uint64_t start_ns = monotonic_ns();
+
+    for (uint64_t block = 0; !atomic_load(&stream->stop); block++) {
+        uint64_t produce_ns = start_ns + block * block_ns;
+        if (!shm_output.free_running && monotonic_ns() < produce_ns) {
+            struct timespec due = { (time_t)(produce_ns / 1000000000ULL), (long)(produce_ns % 1000000000ULL) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+        }
+        uint64_t play_ns = produce_ns + SHM_PREFILL_SLOTS * block_ns;
+
+        // With no consumer attached a full ring is dropped at once instead of backing off
+        ChordShmSlot* slot = shm_ring_acquire(ring, atomic_load(&ring->consumer_pid) != 0 ? block_ns : 0);
+        float* out = slot != NULL ? chordshm_samples(slot) : shm_output.scratch;
+        PaStreamCallbackTimeInfo time_info = {
+            .currentTime = monotonic_seconds(),
+            .outputBufferDacTime = play_ns / 1e9
+        };
+        int result = stream->callback(NULL, out, frames, &time_info, 0, stream->user_data);
+        if (slot != NULL) {
+            slot->frame = shm_output.frames;
+            slot->play_ns = play_ns;
+            slot->frames = (uint32_t)frames;
+            slot->flags = shm_block_is_silent(out, frames) ? CHORDSHM_FLAG_SILENT : 0;
+            slot->publish_ns = monotonic_ns();
+            shm_ring_publish(ring);
+        } else {
+            atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+        }
+        shm_output.frames += frames;
+        if (result != paContinue) {
+            break;
+        }
+    }
+    atomic_store(&stream->active, 0);
+    return NULL;
+}
+
+// --- Output streams ---
+// The playback paths open, run and close streams through these, so they work the same on
+// PortAudio and on the shared-memory ring.
+
+typedef struct {
+    PaStream* pa;                  // NULL when the stream feeds the shared-memory ring
+    ShmStream shm;
+} OutputStream;
+
+PaError output_open(OutputStream* stream, PaStreamCallback* callback, void* userData) {
+    memset(stream, 0, sizeof(*stream));
+    if (shm_output.ring != NULL) {
+        reverb_reset(&reverb);
+        limiter_reset(&limiter);
+        stream->shm.callback = callback;
+        stream->shm.user_data = userData;
+        return paNoError;
+    }
+    Pa_Initialize();
+    PaError error = open_output_stream(&stream->pa, callback, userData);
+    if (error != paNoError) {
+        Pa_Terminate();
+    }
+    return error;
+}
+
+void output_start(OutputStream* stream) {
+    if (stream->pa != NULL) {
+        Pa_StartStream(stream->pa);
+        return;
+    }
+    atomic_store(&stream->shm.active, 1);
+    if (pthread_create(&stream->shm.thread, NULL, shm_stream_thread, &stream->shm) != 0) {
+        atomic_store(&stream->shm.active, 0);
+    }
+}
+
+int output_is_active(OutputStream* stream) {
+    return stream->pa != NULL ? Pa_IsStreamActive(stream->pa) == 1 : atomic_load(&stream->shm.active);
+}
+
+void output_close(OutputStream* stream) {
+    if (stream->pa != NULL) {
+        Pa_StopStream(stream->pa);
+        Pa_CloseStream(stream->pa);
+        Pa_Terminate();
+        return;
+    }
+    atomic_store(&stream->shm.stop, 1);
+    pthread_join(stream->shm.thread, NULL);
+}
+
+typedef struct {
+
+    float buffer[BUFFER_SIZE];
+
+    int index;
+
+} AudioData;
+
+
+
+static int audio_callback(const void* input, void* output, unsigned long framesPerBuffer,
+
+                          const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) {
+
+    rt_prepare_callback_thread();
+
+    RT_CALLBACK_ENTER();
+
+    latency_note_status(statusFlags);
+
+    AudioData* data = (AudioData*)userData;
+
+    float* out = (float*)output;
+
+    int index = data->index;
+
+    for (unsigned int i = 0; i < framesPerBuffer; i++) {
+
+        *out++ = data->buffer[index];
+
+        if (++index == BUFFER_SIZE) {
+
+            index = 0;
+
+        }
+
+    }
+
+    data->index = index;
+
+    output_bus_process((float*)output, framesPerBuffer);
+
+    RT_CALLBACK_EXIT();
+
+    return paContinue;
+
+}
+
+
+
+// --- Oscillators ---
+// Voices are rendered by the engine: exact sines, PolyBLEP/PolyBLAMP band-limited saw,
+// square and triangle, and Karplus-Strong plucked strings.
+
+#define TIMBRE_SINE CE_TIMBRE_SINE
+#define TIMBRE_SAW CE_TIMBRE_SAW
+#define TIMBRE_SQUARE CE_TIMBRE_SQUARE
+#define TIMBRE_TRIANGLE CE_TIMBRE_TRIANGLE
+#define TIMBRE_PLUCK CE_TIMBRE_PLUCK
+
+int current_timbre = TIMBRE_SINE;
+CePluck current_pluck = { CE_DEFAULT_PLUCK_DAMPING, CE_DEFAULT_PLUCK_BRIGHTNESS };
+
+// Amplitude of one voice in a chord: equal-loudness gain, with the chord level falling as
+// 1/sqrt(num_notes) so its loudness stays roughly constant. Peaks above full scale are left
+// to the output limiter.
+static double voice_amplitude(const Note* note, int num_notes) {
+    return ce_voice_amplitude(get_loudness_gain(note->step, note->octave), num_notes);
+}
+
+static int render_chord(Note* selected_notes, int num_notes, AudioData* audioData, const atomic_int* cancel) {
+
+    memset(audioData->buffer, 0, sizeof(audioData->buffer));
+
+    audioData->index = 0;
+
+    double frequencies[NUM_NOTES];
+    float amplitudes[NUM_NOTES];
+    int num_voices = num_notes > NUM_NOTES ? NUM_NOTES : num_notes;
+    for (int i = 0; i < num_voices; i++) {
+        frequencies[i] = selected_notes[i].frequency;
+        amplitudes[i] = (float)voice_amplitude(&selected_notes[i], num_notes);
+    }
+    if (current_timbre == TIMBRE_PLUCK) {
+        return ce_render_plucked(frequencies, amplitudes, num_voices, &current_pluck, SAMPLE_RATE,
+                                 audioData->buffer, BUFFER_SIZE, cancel);
+    }
+    return ce_render_voices(frequencies, amplitudes, num_voices, current_timbre, SAMPLE_RATE, 0,
+                            audioData->buffer, BUFFER_SIZE, cancel);
+
+}
+
+// Render the chord into audioData. Returns 0 if *cancel was raised part way through.
+int generate_wavetable_cancellable(Note* selected_notes, int num_notes, AudioData* audioData, const atomic_int* cancel) {
+    TRACE_BEGIN(render);
+    int completed = render_chord(selected_notes, num_notes, audioData, cancel);
+    TRACE_END(render, "generate_wavetable");
+    return completed;
+}
+
+void generate_wavetable(Note* selected_notes, int num_notes, AudioData* audioData) {
+    generate_wavetable_cancellable(selected_notes, num_notes, audioData, NULL);
+}
+
+// Play an already rendered wavetable for three seconds
+void play_wavetable(AudioData* audioData) {
+
+    if (headless) {
+        return;  // null sink
+    }
+
+    audioData->index = 0;
+
+    rt_prefault(audioData, sizeof(AudioData));
+
+
+
+    TRACE_BEGIN(open);
+
+    OutputStream stream;
+
+    if (output_open(&stream, audio_callback, audioData) != paNoError) {
+
+        return;
+
+    }
+
+    output_start(&stream);
+
+    TRACE_END(open, "stream_open");
+
+    TRACE_BEGIN(playback);
+
+    Pa_Sleep(3000);
+
+    TRACE_END(playback, "playback");
+
+    TRACE_BEGIN(close);
+
+    output_close(&stream);
+
+    TRACE_END(close, "stream_close");
+
+    latency_adapt();
+
+    rt_report_status();
+
+}
+
+// --- Rendered chord cache ---
+// Rendered wavetables are kept in an LRU cache keyed by note set, timbre and the sound
+// settings they were rendered with, so repeats, solos and replays after invalid input are
+// pure playback, and a settings change can never play stale audio. Entries in use are pinned.
+
+#define DEFAULT_RENDER_CACHE_MB 64
+#define MIN_RENDER_CACHE_ENTRIES 4  // current turn + prefetched turn + solo note, with one spare
+
+typedef struct {
+    int timbre;
+    int num_notes;
+    int note_numbers[NUM_NOTES];  // octave * CE_MAX_TUNING_STEPS + step of each voice, in chord order
+    uint64_t sound;               // hash of the voices' frequencies and gains, and the pluck controls
+} RenderKey;
+
+typedef struct {
+    RenderKey key;
+    AudioData* audio;
+    unsigned long last_used;
+    int pins;
+} RenderCacheEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    RenderCacheEntry* entries;
+    int capacity;
+    int count;
+    unsigned long tick;
+    long hits;
+    long misses;
+    long evictions;
+} RenderCache;
+
+RenderCache render_cache;
+
+int render_cache_init(RenderCache* cache, size_t budget_bytes) {
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->capacity = budget_bytes / sizeof(AudioData);
+    if (cache->capacity < MIN_RENDER_CACHE_ENTRIES) {
+        cache->capacity = MIN_RENDER_CACHE_ENTRIES;
+    }
+    cache->entries = calloc(cache->capacity, sizeof(RenderCacheEntry));
+    if (cache->entries == NULL) {
+        printf("Error: Could not allocate render cache\n");
+        return 0;
+    }
+    return 1;
+}
+
+void render_cache_destroy(RenderCache* cache) {
+    for (int e = 0; e < cache->count; e++) {
+        free(cache->entries[e].audio);
+    }
+    free(cache->entries);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+void make_render_key(Note* notes, int num_notes, int timbre, RenderKey* key) {
+    memset(key, 0, sizeof(*key));
+    key->timbre = timbre;
+    key->num_notes = num_notes > NUM_NOTES ? NUM_NOTES : num_notes;
+    for (int i = 0; i < key->num_notes; i++) {
+        key->note_numbers[i] = notes[i].octave * CE_MAX_TUNING_STEPS + notes[i].step;
+    }
+    // Everything else render_chord reads, so tuning, A reference, loudness and pluck changes miss
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < key->num_notes; i++) {
+        double gain = get_loudness_gain(notes[i].step, notes[i].octave);
+        hash = fnv1a(hash, &notes[i].frequency, sizeof(notes[i].frequency));
+        hash = fnv1a(hash, &gain, sizeof(gain));
+    }
+    if (timbre == TIMBRE_PLUCK) {
+        hash = fnv1a(hash, &current_pluck, sizeof(current_pluck));
+    }
+    key->sound = hash;
+}
+
+// Caller holds the lock
+static RenderCacheEntry* render_cache_find(RenderCache* cache, const RenderKey* key) {
+    for (int e = 0; e < cache->count; e++) {
+        if (memcmp(&cache->entries[e].key, key, sizeof(*key)) == 0) {
+            return &cache->entries[e];
+        }
+    }
+    return NULL;
+}
+
+// Return a pinned entry holding the rendered notes, rendering them on a miss. Returns NULL
+// if the render was cancelled or every slot is pinned. Release with render_cache_release.
+RenderCacheEntry* render_cache_acquire(RenderCache* cache, Note* notes, int num_notes, const atomic_int* cancel) {
+    TRACE_BEGIN(lookup);
+    RenderKey key;
+    make_render_key(notes, num_notes, current_timbre, &key);
+
+    pthread_mutex_lock(&cache->lock);
+    RenderCacheEntry* entry = render_cache_find(cache, &key);
+    if (entry != NULL) {
+        cache->hits++;
+        entry->pins++;
+        entry->last_used = ++cache->tick;
+        pthread_mutex_unlock(&cache->lock);
+        TRACE_END(lookup, "render_cache_hit");
+        return entry;
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    TRACE_END(lookup, "render_cache_miss");
+
+    // Render outside the lock so the other thread is never blocked on synthesis
+    AudioData* audio = malloc(sizeof(AudioData));
+    if (audio == NULL) {
+        return NULL;
+    }
+    if (!generate_wavetable_cancellable(notes, num_notes, audio, cancel)) {
+        free(audio);
+        return NULL;
+    }
+    rt_lock_buffer(audio, sizeof(AudioData));
+
+    pthread_mutex_lock(&cache->lock);
+    entry = render_cache_find(cache, &key);  // the other thread may have rendered it meanwhile
+    if (entry != NULL) {
+        free(audio);
+    } else if (cache->count < cache->capacity) {
+        entry = &cache->entries[cache->count++];
+    } else {
+        // Evict the least recently used unpinned entry
+        for (int e = 0; e < cache->count; e++) {
+            RenderCacheEntry* candidate = &cache->entries[e];
+            if (candidate->pins == 0 && (entry == NULL || candidate->last_used < entry->last_used)) {
+                entry = candidate;
+            }
+        }
+        if (entry == NULL) {
+            pthread_mutex_unlock(&cache->lock);
+            free(audio);
+            return NULL;
+        }
+        free(entry->audio);
+        entry->audio = NULL;
+        cache->evictions++;
+    }
+    if (entry->audio == NULL) {
+        entry->key = key;
+        entry->audio = audio;
+        entry->pins = 0;
+    }
+    entry->pins++;
+    entry->last_used = ++cache->tick;
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+void render_cache_release(RenderCache* cache, RenderCacheEntry* entry) {
+    if (entry == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    entry->pins--;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void print_render_cache_stats(RenderCache* cache) {
+    pthread_mutex_lock(&cache->lock);
+    long lookups = cache->hits + cache->misses;
+    printf("  render cache: %ld hits | %ld misses | %ld evictions | %.1f%% hit rate | %d/%d entries (%.1f MB)\n",
+           cache->hits, cache->misses, cache->evictions, lookups > 0 ? 100.0 * cache->hits / lookups : 0.0,
+           cache->count, cache->capacity, cache->count * sizeof(AudioData) / (1024.0 * 1024.0));
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// --- Event sequencer ---
+// Note events are scheduled at exact sample offsets and mixed inside the stream callback,
+// so solos, arpeggios and melodies keep time without stream restarts between notes.
+
+#define MAX_SEQUENCE_EVENTS 64
+#define RELEASE_FRAMES 240  // 5 ms fade at the end of each event to avoid clicks
+#define DEFAULT_TEMPO_BPM 60
+
+typedef enum {
+    PLAY_CHORD,     // all notes together (the default)
+    PLAY_ARPEGGIO,  // chord tones entering low to high on eighth notes and ringing on
+    PLAY_MELODY     // melodic dictation: one note per beat in a random order
+} PresentationMode;
+
+typedef enum {
+    SEQUENCE_SOLO,
+    SEQUENCE_ARPEGGIO,
+    SEQUENCE_MELODY
+} SequenceStyle;
+
+typedef struct {
+    long start_frame;      // offset from the start of the sequence
+    long length_frames;
+    const float* samples;  // rendered voice, at least length_frames long
+    float gain;
+    int label;             // note index announced when the event starts, or -1
+} SequenceEvent;
+
+typedef struct {
+    SequenceEvent events[MAX_SEQUENCE_EVENTS];
+    int num_events;
+    long length_frames;          // length of one pass
+    int loop_count;              // number of passes to play
+    // Playback state, written only by the callback and read by the UI thread with acquire loads
+    atomic_long frame;           // position within the current pass
+    atomic_int pass;
+    atomic_long frames_played;   // across all passes
+    // Callback timing, in samples against the stream clock
+    double first_dac_time;
+    long callbacks;
+    double max_jitter_frames;
+    double total_jitter_frames;
+} Sequencer;
+
+PresentationMode presentation_mode = PLAY_CHORD;
+int tempo_bpm = DEFAULT_TEMPO_BPM;
+int sequence_loops = 1;
+
+long frames_per_beat(void) {
+    return (long)SAMPLE_RATE * 60 / tempo_bpm;
+}
+
+void sequencer_init(Sequencer* seq, long length_frames, int loop_count) {
+    memset(seq, 0, sizeof(*seq));
+    seq->length_frames = length_frames;
+    seq->loop_count = loop_count < 1 ? 1 : loop_count;
+}
+
+void sequencer_add(Sequencer* seq, const float* samples, long start_frame, long length_frames, float gain, int label) {
+    if (seq->num_events >= MAX_SEQUENCE_EVENTS) {
+        return;
+    }
+    if (length_frames > BUFFER_SIZE) {
+        length_frames = BUFFER_SIZE;
+    }
+    seq->events[seq->num_events++] = (SequenceEvent){
+        .start_frame = start_frame,
+        .length_frames = length_frames,
+        .samples = samples,
+        .gain = gain,
+        .label = label
+    };
+}
+
+// Mix the events overlapping [from, from + count) of the current pass into out
+static void sequencer_mix(const Sequencer* seq, float* out, long from, long count) {
+    for (int e = 0; e < seq->num_events; e++) {
+        const SequenceEvent* event = &seq->events[e];
+        long event_end = event->start_frame + event->length_frames;
+        long begin = from > event->start_frame ? from : event->start_frame;
+        long end = from + count < event_end ? from + count : event_end;
+        long release_start = event_end - RELEASE_FRAMES;
+
+        for (long f = begin; f < end; f++) {
+            float gain = event->gain;
+            if (f >= release_start) {
+                gain *= (float)(event_end - f) / RELEASE_FRAMES;
+            }
+            out[f - from] += gain * event->samples[f - event->start_frame];
+        }
+    }
+}
+
+// Render the next block. Returns 1 once every pass has been played.
+int sequencer_render(Sequencer* seq, float* out, unsigned long frames) {
+    memset(out, 0, frames * sizeof(float));
+    unsigned long written = 0;
+    long frame = atomic_load_explicit(&seq->frame, memory_order_relaxed);
+    int pass = atomic_load_explicit(&seq->pass, memory_order_relaxed);
+    long frames_played = atomic_load_explicit(&seq->frames_played, memory_order_relaxed);
+
+    while (written < frames && pass < seq->loop_count) {
+        long chunk = seq->length_frames - frame;
+        if (chunk > (long)(frames - written)) {
+            chunk = frames - written;
+        }
+        sequencer_mix(seq, out + written, frame, chunk);
+        written += chunk;
+        frames_played += chunk;
+        if (frame + chunk >= seq->length_frames) {
+            frame = 0;
+            pass++;
+        } else {
+            frame += chunk;
+        }
+    }
+    atomic_store_explicit(&seq->frame, frame, memory_order_release);
+    atomic_store_explicit(&seq->pass, pass, memory_order_release);
+    atomic_store_explicit(&seq->frames_played, frames_played, memory_order_release);
+    return pass >= seq->loop_count;
+}
+
+// Compare each block's DAC time with where the sample clock says it should be
+static void sequencer_measure_jitter(Sequencer* seq, const PaStreamCallbackTimeInfo* timeInfo) {
+    if (timeInfo == NULL || timeInfo->outputBufferDacTime <= 0.0) {
+        return;  // host API does not report stream time
+    }
+    if (seq->callbacks == 0) {
+        seq->first_dac_time = timeInfo->outputBufferDacTime;
+    } else {
+        double expected = seq->first_dac_time + (double)atomic_load_explicit(&seq->frames_played, memory_order_relaxed) / SAMPLE_RATE;
+        double jitter = fabs(timeInfo->outputBufferDacTime - expected) * SAMPLE_RATE;
+        seq->total_jitter_frames += jitter;
+        if (jitter > seq->max_jitter_frames) {
+            seq->max_jitter_frames = jitter;
+        }
+    }
+    seq->callbacks++;
+}
+
+static int sequencer_callback(const void* input, void* output, unsigned long framesPerBuffer,
+                              const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) {
+    rt_prepare_callback_thread();
+    RT_CALLBACK_ENTER();
+    latency_note_status(statusFlags);
+    Sequencer* seq = (Sequencer*)userData;
+    sequencer_measure_jitter(seq, timeInfo);
+    int finished = sequencer_render(seq, (float*)output, framesPerBuffer);
+    output_bus_process((float*)output, framesPerBuffer);
+    RT_CALLBACK_EXIT();
+    return finished ? paComplete : paContinue;
+}
+
+// Play a sequence on one stream, announcing labelled events as they start
+void play_sequence(Sequencer* seq, Note* notes) {
+    int announced = 0;
+    long total_frames = seq->length_frames * seq->loop_count;
+
+    if (headless) {
+        for (int e = 0; e < seq->num_events; e++) {
+            if (seq->events[e].label >= 0) {
+                Note* note = &notes[seq->events[e].label];
+                printf("note [%d] is [%s] at %.2fHz\n", seq->events[e].label + 1, note->name, note->frequency);
+            }
+        }
+        return;  // null sink
+    }
+
+    rt_lock_buffer(seq, sizeof(*seq));
+    rt_prefault(seq, sizeof(*seq));
+    for (int e = 0; e < seq->num_events; e++) {
+        rt_prefault(seq->events[e].samples, seq->events[e].length_frames * sizeof(float));
+    }
+
+    TRACE_BEGIN(open);
+    OutputStream stream;
+    if (output_open(&stream, sequencer_callback, seq) != paNoError) {
+        return;
+    }
+    output_start(&stream);
+    TRACE_END(open, "stream_open");
+
+    TRACE_BEGIN(playback);
+    while (output_is_active(&stream) && atomic_load_explicit(&seq->frames_played, memory_order_acquire) < total_frames) {
+        // Announce from the UI thread; event timing itself is fixed by the callback
+        while (announced < seq->num_events && atomic_load_explicit(&seq->pass, memory_order_acquire) == 0 &&
+               atomic_load_explicit(&seq->frame, memory_order_acquire) >= seq->events[announced].start_frame) {
+            SequenceEvent* event = &seq->events[announced++];
+            if (event->label >= 0) {
+                Note* note = &notes[event->label];
+                printf("note [%d] is [%s] at %.2fHz\n", event->label + 1, note->name, note->frequency);
+                fflush(stdout);
+            }
+        }
+        Pa_Sleep(5);
+    }
+
+    TRACE_END(playback, "sequence_playback");
+    TRACE_BEGIN(close);
+    output_close(&stream);
+    TRACE_END(close, "stream_close");
+    rt_report_status();
+    latency_adapt();
+
+    for (; announced < seq->num_events; announced++) {
+        if (seq->events[announced].label >= 0) {
+            Note* note = &notes[seq->events[announced].label];
+            printf("note [%d] is [%s] at %.2fHz\n", seq->events[announced].label + 1, note->name, note->frequency);
+        }
+    }
+
+    if (report_timing && seq->callbacks > 1) {
+        printf("Sequencer: %d events over %ld frames, callback jitter max %.1f / mean %.1f samples\n",
+               seq->num_events, total_frames, seq->max_jitter_frames,
+               seq->total_jitter_frames / (seq->callbacks - 1));
+    }
+}
+
+// Schedule each note as its own voice and play them in the given style
+void play_note_sequence(Note* notes, int num_notes, SequenceStyle style) {
+    RenderCacheEntry* entries[NUM_NOTES] = {NULL};
+    if (num_notes > NUM_NOTES) {
+        num_notes = NUM_NOTES;
+    }
+
+    if (!headless || headless_render) {
+        for (int i = 0; i < num_notes; i++) {
+            Note single_note[1] = { notes[i] };
+            entries[i] = render_cache_acquire(&render_cache, single_note, 1, NULL);
+            if (entries[i] == NULL) {
+                // Playing on with a note missing would leave a silent beat the player cannot explain
+                printf("Error: Could not render note [%s] for the sequence\n", notes[i].name);
+                for (int j = 0; j < i; j++) {
+                    render_cache_release(&render_cache, entries[j]);
+                }
+                return;
+            }
+        }
+    }
+
+    long beat = frames_per_beat();
+    Sequencer seq;
+
+    if (style == SEQUENCE_ARPEGGIO) {
+        long step = beat / 2;
+        long length = step * (num_notes - 1) + 2 * beat;
+        sequencer_init(&seq, length, sequence_loops);
+        for (int i = 0; i < num_notes; i++) {
+            if (entries[i] != NULL) {
+                sequencer_add(&seq, entries[i]->audio->buffer, step * i, length - step * i, 1.0f / sqrtf(num_notes), -1);
+            }
+        }
+    } else {
+        sequencer_init(&seq, beat * num_notes, style == SEQUENCE_MELODY ? sequence_loops : 1);
+        for (int i = 0; i < num_notes; i++) {
+            if (entries[i] != NULL || headless) {
+                sequencer_add(&seq, entries[i] != NULL ? entries[i]->audio->buffer : NULL, beat * i, beat, 1.0f,
+                              style == SEQUENCE_SOLO ? i : -1);
+            }
+        }
+    }
+
+    play_sequence(&seq, notes);
+
+    for (int i = 0; i < num_notes; i++) {
+        render_cache_release(&render_cache, entries[i]);
+    }
+}
+
+void play_audio(Note* selected_notes, int num_notes) {
+
+    if (presentation_mode != PLAY_CHORD) {
+        play_note_sequence(selected_notes, num_notes, presentation_mode == PLAY_MELODY ? SEQUENCE_MELODY : SEQUENCE_ARPEGGIO);
+        return;
+    }
+
+    if (headless && !headless_render) {
+        return;
+    }
+
+    RenderCacheEntry* entry = render_cache_acquire(&render_cache, selected_notes, num_notes, NULL);
+
+    if (entry != NULL) {
+
+        play_wavetable(entry->audio);
+
+        render_cache_release(&render_cache, entry);
+
+        return;
+
+    }
+
+    // Cache full of pinned entries; render on the heap without caching
+    AudioData* audioData = malloc(sizeof(AudioData));
+
+    if (audioData != NULL) {
+
+        generate_wavetable(selected_notes, num_notes, audioData);
+
+        play_wavetable(audioData);
+
+        free(audioData);
+
+    }
+
+}
+
+// --- Next-turn prefetch ---
+// The engine picks each turn's notes one turn ahead. While the player answers, a worker
+// thread renders that next turn into the render cache, so sound can start as soon as a
+// turn is judged.
+
+// Bumped whenever the sound changes; stale prefetches are discarded
+unsigned long game_config_version = 0;
+
+typedef struct {
+    pthread_t thread;
+    int active;                    // worker started and not yet joined
+    atomic_int cancel;
+    unsigned long config_version;  // game_config_version the render was started for
+    int num_notes;
+    Note selected[NUM_NOTES];
+    RenderCacheEntry* entry;       // pinned render of 'selected', NULL if none
+    atomic_int ready;              // worker completed without being cancelled
+} TurnPrefetch;
+
+static void* prefetch_worker(void* arg) {
+    TurnPrefetch* prefetch = (TurnPrefetch*)arg;
+    enable_flush_denormals();
+    if (headless && !headless_render) {
+        // null sink: nothing to synthesize
+    } else if (presentation_mode == PLAY_CHORD) {
+        prefetch->entry = render_cache_acquire(&render_cache, prefetch->selected, prefetch->num_notes, &prefetch->cancel);
+    } else {
+        // Sequenced turns play individual voices; warm the cache with each of them
+        for (int i = 0; i < prefetch->num_notes && !atomic_load(&prefetch->cancel); i++) {
+            Note single_note[1] = { prefetch->selected[i] };
+            render_cache_release(&render_cache, render_cache_acquire(&render_cache, single_note, 1, &prefetch->cancel));
+        }
+    }
+    atomic_store(&prefetch->ready, !atomic_load(&prefetch->cancel));
+    return NULL;
+}
+
+void prefetch_init(TurnPrefetch* prefetch) {
+    memset(prefetch, 0, sizeof(*prefetch));
+}
+
+// Start rendering the engine's next turn in the background
+void prefetch_start(TurnPrefetch* prefetch, const Note* notes, int num_notes) {
+    atomic_store(&prefetch->cancel, 0);
+    atomic_store(&prefetch->ready, 0);
+    prefetch->entry = NULL;
+    prefetch->config_version = game_config_version;
+    prefetch->num_notes = num_notes > NUM_NOTES ? NUM_NOTES : num_notes;
+    memcpy(prefetch->selected, notes, sizeof(Note) * prefetch->num_notes);
+    if (pthread_create(&prefetch->thread, NULL, prefetch_worker, prefetch) == 0) {
+        prefetch->active = 1;
+    }
+}
+
+// Abandon a render in progress, e.g. when the configuration changes or the game quits
+void prefetch_cancel(TurnPrefetch* prefetch) {
+    if (prefetch->active) {
+        atomic_store(&prefetch->cancel, 1);
+        pthread_join(prefetch->thread, NULL);
+        prefetch->active = 0;
+        render_cache_release(&render_cache, prefetch->entry);
+        prefetch->entry = NULL;
+    }
+}
+
+// Change the sound after startup. Each of these bumps game_config_version, so a turn
+// prefetched with the old settings is rendered again instead of played. Cancel any
+// prefetch in progress first; the worker reads these settings while it renders.
+void set_timbre(int timbre) {
+    current_timbre = timbre;
+    game_config_version++;
+}
+
+void set_pluck(CePluck pluck) {
+    current_pluck = pluck;
+    game_config_version++;
+}
+
+void set_loudness(double phon) {
+    loudness_phon = phon;
+    ce_loudness_table(&current_tuning, loudness_phon, loudness_table);
+    game_config_version++;
+}
+
+int set_tuning(const char* spec, int root, double a4, char* error, size_t error_size) {
+    if (!ce_tuning_load(&current_tuning, spec, root, a4, error, error_size)) {
+        return 0;
+    }
+    ce_loudness_table(&current_tuning, loudness_phon, loudness_table);
+    game_config_version++;
+    return 1;
+}
+
+// Wait for the prefetched render. On success hands over the pinned render (NULL for a
+// silent headless run) and returns 1. Returns 0 if there is no usable prefetch, in which
+// case the caller renders the turn itself.
+int prefetch_finish(TurnPrefetch* prefetch, RenderCacheEntry** entry) {
+    if (!prefetch->active) {
+        return 0;
+    }
+    pthread_join(prefetch->thread, NULL);
+    prefetch->active = 0;
+    if (!atomic_load(&prefetch->ready) || prefetch->config_version != game_config_version) {
+        render_cache_release(&render_cache, prefetch->entry);
+        prefetch->entry = NULL;
+        return 0;
+    }
+    *entry = prefetch->entry;
+    prefetch->entry = NULL;
+    return 1;
+}
+
+// Play each note on its own, one per beat, announcing its name as it sounds
+void solo_audio(Note* selected_notes, int num_notes) {
+
+    play_note_sequence(selected_notes, num_notes, SEQUENCE_SOLO);
+
+}
+
+
+
+// --- Reveal visualizer ---
+// After a turn is judged, the chord is replayed under a live spectrum with a piano roll.
+// One column per semitone, so each bar sits over its key. Frames are drawn into a cell
+// grid and only cells that changed since the last frame are written to the terminal.
+
+#define VIS_FFT_SIZE 4096
+#define VIS_ROWS 14
+#define VIS_MAX_COLUMNS (NUM_NOTES * NUM_OCTAVES)
+#define VIS_FLOOR_DB -60.0f
+#define VIS_DEFAULT_FPS 30
+
+typedef struct {
+    char ch;
+    unsigned char colour;  // 0 = default, 1 = green, 2 = red
+} Cell;
+
+#define VIS_SCREEN_ROWS (VIS_ROWS + 3)
+
+typedef struct {
+    Cell cells[VIS_SCREEN_ROWS][VIS_MAX_COLUMNS];
+    Cell shown[VIS_SCREEN_ROWS][VIS_MAX_COLUMNS];  // what the terminal currently displays
+    char output[VIS_SCREEN_ROWS * VIS_MAX_COLUMNS * 16];
+} Screen;
+
+typedef struct {
+    pthread_t thread;
+    atomic_int running;
+    Note* notes;
+    int num_notes;
+    int low_octave;
+    int columns;
+    float window[VIS_FFT_SIZE];
+    float samples[VIS_FFT_SIZE];
+    Complex spectrum[VIS_FFT_SIZE];
+    int key_bin_low[VIS_MAX_COLUMNS];   // FFT bins within a quarter tone of each key
+    int key_bin_high[VIS_MAX_COLUMNS];
+    FftPlan plan;
+    Screen screen;
+    long frames_drawn;
+    long bytes_written;
+    double analysis_seconds;
+} Visualizer;
+
+int reveal_mode = 0;
+int reveal_fps = VIS_DEFAULT_FPS;
+
+static const char* vis_colour_codes[] = {ANSI_COLOUR_RESET, ANSI_COLOUR_GREEN, ANSI_COLOUR_RED};
+
+// Emit the changed cells as cursor moves and runs of characters in one write()
+void screen_flush(Screen* screen, int columns, long* bytes_written) {
+    char* out = screen->output;
+    int cursor_row = -1, cursor_col = -1, colour = -1;
+
+    for (int r = 0; r < VIS_SCREEN_ROWS; r++) {
+        for (int c = 0; c < columns; c++) {
+            Cell cell = screen->cells[r][c];
+            if (cell.ch == screen->shown[r][c].ch && cell.colour == screen->shown[r][c].colour) {
+                continue;
+            }
+            if (r != cursor_row || c != cursor_col) {
+                out += sprintf(out, "\x1b[%d;%dH", r + 1, c + 1);
+            }
+            if (cell.colour != colour) {
+                out += sprintf(out, "%s", vis_colour_codes[cell.colour]);
+                colour = cell.colour;
+            }
+            *out++ = cell.ch;
+            cursor_row = r;
+            cursor_col = c + 1;
+            screen->shown[r][c] = cell;
+        }
+    }
+    if (out != screen->output) {
+        out += sprintf(out, "%s\x1b[%d;1H", ANSI_COLOUR_RESET, VIS_SCREEN_ROWS + 1);
+        ssize_t written = write(STDOUT_FILENO, screen->output, out - screen->output);
+        if (written > 0) {
+            *bytes_written += written;
+        }
+    }
+}
+
+static int is_black_key(int pitch_class) {
+    return pitch_class == 1 || pitch_class == 3 || pitch_class == 6 || pitch_class == 8 || pitch_class == 10;
+}
+
+void visualizer_draw_frame(Visualizer* vis) {
+    double started = monotonic_seconds();
+
+    audio_tap_read_latest(vis->samples, VIS_FFT_SIZE);
+    for (int i = 0; i < VIS_FFT_SIZE; i++) {
+        vis->spectrum[i].re = vis->samples[i] * vis->window[i];
+        vis->spectrum[i].im = 0.0f;
+    }
+    fft_execute(&vis->plan, vis->spectrum, 0);
+
+    Screen* screen = &vis->screen;
+    for (int c = 0; c < vis->columns; c++) {
+        float peak = 0.0f;
+        for (int bin = vis->key_bin_low[c]; bin <= vis->key_bin_high[c]; bin++) {
+            float power = vis->spectrum[bin].re * vis->spectrum[bin].re + vis->spectrum[bin].im * vis->spectrum[bin].im;
+            if (power > peak) {
+                peak = power;
+            }
+        }
+        // Full-scale sine with a Hann window peaks at N/4
+        float db = 10.0f * log10f(peak / ((VIS_FFT_SIZE / 4.0f) * (VIS_FFT_SIZE / 4.0f)) + 1e-12f);
+        int height = (int)((db - VIS_FLOOR_DB) / -VIS_FLOOR_DB * VIS_ROWS + 0.5f);
+        for (int r = 0; r < VIS_ROWS; r++) {
+            int filled = VIS_ROWS - r <= height;
+            screen->cells[r][c] = (Cell){ filled ? '|' : ' ', 0 };
+        }
+    }
+
+    // Piano roll: keys of the chord that is sounding, plus octave labels
+    for (int c = 0; c < vis->columns; c++) {
+        int pitch_class = c % NUM_NOTES;
+        Cell key = { is_black_key(pitch_class) ? '^' : '_', 0 };
+        for (int n = 0; n < vis->num_notes; n++) {
+            if (vis->notes[n].pitch_class == pitch_class && vis->notes[n].octave == vis->low_octave + c / NUM_NOTES) {
+                key = (Cell){ '#', 1 };
+                for (int r = 0; r < VIS_ROWS; r++) {
+                    if (screen->cells[r][c].ch == '|') {
+                        screen->cells[r][c].colour = 1;
+                    }
+                }
+            }
+        }
+        screen->cells[VIS_ROWS][c] = key;
+        screen->cells[VIS_ROWS + 1][c] = (Cell){ ' ', 0 };
+    }
+    for (int c = 0; c < vis->columns; c += NUM_NOTES) {
+        char label[8];
+        int length = snprintf(label, sizeof(label), "C%d", vis->low_octave + c / NUM_NOTES);
+        for (int k = 0; k < length && c + k < vis->columns; k++) {
+            screen->cells[VIS_ROWS + 1][c + k] = (Cell){ label[k], 0 };
+        }
+    }
+
+    vis->analysis_seconds += monotonic_seconds() - started;
+    screen_flush(screen, vis->columns, &vis->bytes_written);
+    vis->frames_drawn++;
+}
+
+static void* visualizer_thread(void* arg) {
+    Visualizer* vis = (Visualizer*)arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long period_ns = 1000000000L / reveal_fps;
+
+    while (atomic_load(&vis->running)) {
+        visualizer_draw_frame(vis);
+        next.tv_nsec += period_ns;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+int visualizer_start(Visualizer* vis, Note* notes, int num_notes) {
+    memset(vis, 0, sizeof(*vis));
+    if (!fft_plan_init(&vis->plan, VIS_FFT_SIZE)) {
+        return 0;
+    }
+    vis->notes = notes;
+    vis->num_notes = num_notes;
+
+    int low = MAX_OCTAVE, high = MIN_OCTAVE;
+    for (int n = 0; n < num_notes; n++) {
+        low = notes[n].octave < low ? notes[n].octave : low;
+        high = notes[n].octave > high ? notes[n].octave : high;
+    }
+    if (high < low) {
+        low = high = 4;
+    }
+    vis->low_octave = low;
+    vis->columns = (high - low + 1) * NUM_NOTES;
+
+    for (int i = 0; i < VIS_FFT_SIZE; i++) {
+        vis->window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / VIS_FFT_SIZE);
+    }
+    for (int c = 0; c < vis->columns; c++) {
+        double frequency = pitch_class_frequency(c % NUM_NOTES, low + c / NUM_NOTES);
+        double quarter_tone = pow(2.0, 1.0 / 24.0);
+        int bin_low = (int)(frequency / quarter_tone * VIS_FFT_SIZE / SAMPLE_RATE);
+        int bin_high = (int)(frequency * quarter_tone * VIS_FFT_SIZE / SAMPLE_RATE + 0.5);
+        vis->key_bin_low[c] = bin_low < 1 ? 1 : bin_low;
+        vis->key_bin_high[c] = bin_high >= VIS_FFT_SIZE / 2 ? VIS_FFT_SIZE / 2 - 1 : bin_high;
+        if (vis->key_bin_high[c] < vis->key_bin_low[c]) {
+            vis->key_bin_high[c] = vis->key_bin_low[c];
+        }
+    }
+    // Force the first frame to draw every cell
+    memset(vis->screen.shown, 0xff, sizeof(vis->screen.shown));
+
+    memset(audio_tap.samples, 0, sizeof(audio_tap.samples));
+    atomic_store(&audio_tap.enabled, 1);
+    atomic_store(&vis->running, 1);
+    fflush(stdout);
+    printf(ANSI_CLEAR_CONSOLE);
+    fflush(stdout);
+    if (pthread_create(&vis->thread, NULL, visualizer_thread, vis) != 0) {
+        atomic_store(&audio_tap.enabled, 0);
+        fft_plan_destroy(&vis->plan);
+        return 0;
+    }
+    return 1;
+}
+
+void visualizer_stop(Visualizer* vis) {
+    atomic_store(&vis->running, 0);
+    pthread_join(vis->thread, NULL);
+    atomic_store(&audio_tap.enabled, 0);
+    fft_plan_destroy(&vis->plan);
+    if (report_timing && vis->frames_drawn > 0) {
+        printf("Visualizer: %ld frames, %.0f bytes/frame, %.1f us analysis/frame\n", vis->frames_drawn,
+               (double)vis->bytes_written / vis->frames_drawn, vis->analysis_seconds * 1e6 / vis->frames_drawn);
+    }
+}
+
+// Replay the turn's notes with the spectrum and piano roll running
+void reveal_turn(Note* selected_notes, int num_notes, RenderCacheEntry* turn_entry) {
+    if (headless) {
+        return;
+    }
+    static Visualizer vis;  // large; kept off the stack
+    int visualizing = visualizer_start(&vis, selected_notes, num_notes);
+    if (turn_entry != NULL) {
+        play_wavetable(turn_entry->audio);
+    } else {
+        play_audio(selected_notes, num_notes);
+    }
+    if (visualizing) {
+        visualizer_stop(&vis);
+    }
+}
+
+
+
+// --- Guess sources for headless runs ---
+
+typedef enum {
+    GUESS_STDIN,
+    GUESS_SCRIPT,
+    GUESS_GEN_CORRECT,
+    GUESS_GEN_WRONG,
+    GUESS_GEN_RANDOM
+} GuessSourceType;
+
+typedef struct {
+    GuessSourceType type;
+    FILE* script;
+    unsigned int rng;  // separate from the engine's generator so the note selection sequence is unaffected
+} GuessSource;
+
+// Open a guess source: a script file, "gen:correct", "gen:wrong" or "gen:random"
+int open_guess_source(const char* spec, GuessSource* source) {
+    source->script = NULL;
+    source->rng = random_seed_set ? random_seed : (unsigned int)time(NULL);
+
+    if (spec == NULL || strcmp(spec, "-") == 0) {
+        source->type = GUESS_STDIN;
+    } else if (strcmp(spec, "gen:correct") == 0) {
+        source->type = GUESS_GEN_CORRECT;
+    } else if (strcmp(spec, "gen:wrong") == 0) {
+        source->type = GUESS_GEN_WRONG;
+    } else if (strcmp(spec, "gen:random") == 0) {
+        source->type = GUESS_GEN_RANDOM;
+    } else {
+        source->type = GUESS_SCRIPT;
+        source->script = fopen(spec, "r");
+        if (source->script == NULL) {
+            printf("Error: Could not open guess script %s\n", spec);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Name of a step other than the answer's, chosen by roll
+static void wrong_guess(const Note* answer, int roll, char* name, int size) {
+    int steps = current_tuning.steps_per_octave;
+    int step = steps > 1 ? (answer->step + 1 + roll % (steps - 1)) % steps : answer->step;
+    ce_step_name(&current_tuning, step, name, size);
+}
+
+// Produce the next raw input line for guess number 'index'. Returns 0 at end of input.
+int next_guess(GuessSource* source, const Note* selected_notes, int index, char* line, int size) {
+    if (source->type == GUESS_STDIN || source->type == GUESS_SCRIPT) {
+        return fgets(line, size, source->type == GUESS_STDIN ? stdin : source->script) != NULL;
+    }
+
+    const Note* answer = &selected_notes[index];
+    int roll = rand_r(&source->rng) % 100;
+    char wrong[8];
+
+    if (source->type == GUESS_GEN_RANDOM) {
+        // 70% correct, 15% wrong, 5% repeat, 4% solo, 3% delete, 3% invalid
+        if (roll < 70) {
+            snprintf(line, size, "%s\n", answer->name);
+        } else if (roll < 85) {
+            wrong_guess(answer, rand_r(&source->rng), wrong, sizeof(wrong));
+            snprintf(line, size, "%s\n", wrong);
+        } else if (roll < 90) {
+            snprintf(line, size, "r\n");
+        } else if (roll < 94) {
+            snprintf(line, size, "s\n");
+        } else if (roll < 97) {
+            snprintf(line, size, "x\n");
+        } else {
+            snprintf(line, size, "h\n");
+        }
+    } else if (source->type == GUESS_GEN_WRONG) {
+        wrong_guess(answer, roll, wrong, sizeof(wrong));
+        snprintf(line, size, "%s\n", wrong);
+    } else {
+        // Alternate spellings so enharmonic handling is exercised too
+        const char* spelling = (roll & 1) && answer->enharmonic_equiv != NULL ? answer->enharmonic_equiv : answer->name;
+        snprintf(line, size, "%s\n", spelling);
+    }
+    return 1;
+}
+
+void print_headless_summary(const CeStats* stats, double elapsed_seconds) {
+    printf("\nHeadless run: %ld turns in %.3f s (%.0f turns/sec)\n",
+           stats->turns, elapsed_seconds, elapsed_seconds > 0.0 ? stats->turns / elapsed_seconds : 0.0);
+    printf("  correct: %ld | incorrect: %ld | repeats: %ld | solos: %ld | deletes: %ld | invalid: %ld | quits: %ld\n",
+           stats->correct, stats->incorrect, stats->repeats, stats->solos, stats->deletes, stats->invalid, stats->quits);
+}
+
+// --- Turn log and analytics ---
+// -log appends one tab-separated line per finished turn:
+//   student  unix_ms  answers  guesses  response_ms  correct
+// where answers are note names with octaves ("A3,C#4") and guesses are pitch classes
+// ("A,C#"), in the order they were asked for. Response time runs from the end of the
+// first playback to the last guess. In tunings that are not 12-step the names are step
+// numbers ("74" is step 7 in octave 4); -analyze reads 12-step logs and counts those
+// lines as malformed.
+//
+// -analyze maps a log and splits it into one byte range per CPU. Each worker parses its
+// lines into fixed-size column batches (one byte per note for the played pitch class,
+// octave, guess and interval cell) and folds every full batch into its own counters with
+// flat loops over those columns, so memory stays bounded however large the log is. The
+// main thread then sums the per-worker counters and prints the report.
+
+#define TURN_LOG_VERSION 1
+#define ANALYTICS_BATCH 65536           // turns per column batch
+#define ANALYTICS_MAX_THREADS 64
+#define ANALYTICS_RT_BIN_MS 10
+#define ANALYTICS_RT_BINS 12001         // 10 ms bins up to two minutes, the last one open-ended
+#define ANALYTICS_TREND_BUCKETS 10      // tenths of the log, in file order
+#define ANALYTICS_FIRST_NOTE 144        // interval cell of a turn's first note, which has none
+#define ANALYTICS_INTERVAL_CELLS 145
+
+typedef struct {
+    FILE* file;
+    char student[64];
+} TurnLog;
+
+int turn_log_open(TurnLog* log, const char* path, const char* student) {
+    // Tabs and newlines would break the line format
+    snprintf(log->student, sizeof(log->student), "%s", student);
+    for (char* c = log->student; *c != '\0'; c++) {
+        *c = isspace((unsigned char)*c) ? '_' : *c;
+    }
+    log->file = fopen(path, "a");
+    if (log->file == NULL) {
+        printf("Error: Could not open turn log %s\n", path);
+        return 0;
+    }
+    if (ftell(log->file) == 0) {
+        fprintf(log->file, "# chordgame turn log v%d: student, unix_ms, answers, guesses, response_ms, correct\n",
+                TURN_LOG_VERSION);
+    }
+    return 1;
+}
+
+void turn_log_write(TurnLog* log, const Note* answers, const int* guessed_steps, int num_notes, double response_seconds, int correct) {
+    if (log->file == NULL) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    fprintf(log->file, "%s\t%lld\t", log->student, (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+    for (int i = 0; i < num_notes; i++) {
+        fprintf(log->file, "%s%s%d", i > 0 ? "," : "", answers[i].name, answers[i].octave);
+    }
+    fputc('\t', log->file);
+    for (int i = 0; i < num_notes; i++) {
+        char name[8];
+        ce_step_name(&current_tuning, guessed_steps[i], name, sizeof(name));
+        fprintf(log->file, "%s%s", i > 0 ? "," : "", name);
+    }
+    fprintf(log->file, "\t%ld\t%d\n", lround(response_seconds * 1000.0), correct);
+    fflush(log->file);
+}
+
+void turn_log_close(TurnLog* log) {
+    if (log->file != NULL) {
+        fclose(log->file);
+        log->file = NULL;
+    }
+}
+
+typedef struct {
+    uint64_t hash;      // 0 = empty slot
+    const char* name;   // in the mapped log
+    size_t name_length;
+    long turns;
+    long correct;
+    double response_ms;
+} StudentTally;
+
+typedef struct {
+    StudentTally* slots;
+    size_t capacity;    // power of two
+    size_t count;
+} StudentTable;
+
+typedef struct {
+    // Input: lines starting in [begin, end) of the mapped log
+    const char* log;
+    size_t log_size;
+    size_t begin;
+    size_t end;
+    const char* student_filter;
+
+    // Current column batch
+    int batch_turns;
+    int batch_notes;
+    uint8_t* played_pc;     // per note
+    uint8_t* octave;
+    uint8_t* guessed_pc;
+    uint8_t* interval_cell; // played interval * 12 + guessed interval, or ANALYTICS_FIRST_NOTE
+    uint16_t* response_bin; // per turn
+    uint8_t* correct;
+    uint8_t* trend_bucket;
+
+    // Running totals
+    long turns;
+    long notes;
+    long malformed;
+    uint64_t pc_confusion[NUM_NOTES * NUM_NOTES];
+    uint64_t interval_confusion[ANALYTICS_INTERVAL_CELLS];
+    uint64_t octave_notes[NUM_OCTAVES];
+    uint64_t octave_correct[NUM_OCTAVES];
+    uint64_t trend_turns[ANALYTICS_TREND_BUCKETS];
+    uint64_t trend_correct[ANALYTICS_TREND_BUCKETS];
+    uint64_t (*response_histogram)[ANALYTICS_RT_BINS];  // [ANALYTICS_TREND_BUCKETS]
+    StudentTable students;
+} AnalyticsWorker;
+
+static const char* interval_names[NUM_NOTES] = {
+    "unison", "minor 2nd", "major 2nd", "minor 3rd", "major 3rd", "perfect 4th",
+    "tritone", "perfect 5th", "minor 6th", "major 6th", "minor 7th", "major 7th"};
+
+// Find or add the tally for a student name. A hash hit only matches if the name does too,
+// so colliding names keep separate tallies.
+static StudentTally* student_table_find(StudentTable* table, uint64_t hash, const char* name, size_t name_length) {
+    if (table->count * 2 >= table->capacity) {
+        size_t capacity = table->capacity == 0 ? 64 : table->capacity * 2;
+        StudentTally* slots = calloc(capacity, sizeof(StudentTally));
+        if (slots == NULL) {
+            return NULL;
+        }
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->slots[i].hash != 0) {
+                size_t j = table->slots[i].hash & (capacity - 1);
+                while (slots[j].hash != 0) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j] = table->slots[i];
+            }
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->capacity = capacity;
+    }
+    size_t i = hash & (table->capacity - 1);
+    while (table->slots[i].hash != 0
+           && (table->slots[i].hash != hash || table->slots[i].name_length != name_length
+               || memcmp(table->slots[i].name, name, name_length) != 0)) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    if (table->slots[i].hash == 0) {
+        table->slots[i].hash = hash;
+        table->slots[i].name = name;
+        table->slots[i].name_length = name_length;
+        table->count++;
+    }
+    return &table->slots[i];
+}
+
+// Parse "C#4" or "C#" at *cursor; returns the pitch class or -1
+static int parse_log_note(const char** cursor, const char* end, int* octave) {
+    static const int letter_pitch_class[7] = {9, 11, 0, 2, 4, 5, 7};  // A..G
+    const char* c = *cursor;
+    if (c >= end || *c < 'A' || *c > 'G') {
+        return -1;
+    }
+    int pc = letter_pitch_class[*c++ - 'A'];
+    if (c < end && *c == '#') {
+        pc = (pc + 1) % NUM_NOTES;
+        c++;
+    }
+    if (octave != NULL) {
+        if (c >= end || *c < '0' || *c > '9') {
+            return -1;
+        }
+        *octave = *c++ - '0';
+    }
+    *cursor = c;
+    return pc;
+}
+
+static long parse_log_integer(const char** cursor, const char* end) {
+    long value = 0;
+    const char* c = *cursor;
+    while (c < end && *c >= '0' && *c <= '9') {
+        value = value * 10 + (*c++ - '0');
+    }
+    *cursor = c;
+    return value;
+}
+
+// Fold the current batch into the worker's counters
+static void analytics_reduce_batch(AnalyticsWorker* w) {
+    for (int n = 0; n < w->batch_notes; n++) {
+        w->pc_confusion[w->played_pc[n] * NUM_NOTES + w->guessed_pc[n]]++;
+    }
+    for (int n = 0; n < w->batch_notes; n++) {
+        w->interval_confusion[w->interval_cell[n]]++;
+    }
+    for (int n = 0; n < w->batch_notes; n++) {
+        w->octave_notes[w->octave[n]]++;
+        w->octave_correct[w->octave[n]] += w->played_pc[n] == w->guessed_pc[n];
+    }
+    for (int t = 0; t < w->batch_turns; t++) {
+        w->trend_turns[w->trend_bucket[t]]++;
+        w->trend_correct[w->trend_bucket[t]] += w->correct[t];
+        w->response_histogram[w->trend_bucket[t]][w->response_bin[t]]++;
+    }
+    w->turns += w->batch_turns;
+    w->notes += w->batch_notes;
+    w->batch_turns = 0;
+    w->batch_notes = 0;
+}
+
+// Parse one line into the batch columns. Returns 0 if it is malformed.
+static int analytics_parse_line(AnalyticsWorker* w, const char* line, const char* end) {
+    const char* c = line;
+    const char* student = c;
+    while (c < end && *c != '\t') {
+        c++;
+    }
+    size_t student_length = c - student;
+    if (c >= end || student_length == 0) {
+        return 0;
+    }
+    if (w->student_filter != NULL
+        && (strlen(w->student_filter) != student_length || memcmp(w->student_filter, student, student_length) != 0)) {
+        return 1;
+    }
+    c++;
+    parse_log_integer(&c, end);  // unix_ms, not used by the report
+    if (c >= end || *c++ != '\t') {
+        return 0;
+    }
+
+    int first = w->batch_notes;
+    int num_notes = 0;
+    while (num_notes < NUM_NOTES) {
+        int octave;
+        int pc = parse_log_note(&c, end, &octave);
+        if (pc < 0 || octave >= NUM_OCTAVES) {
+            return 0;
+        }
+        w->played_pc[first + num_notes] = (uint8_t)pc;
+        w->octave[first + num_notes] = (uint8_t)octave;
+        num_notes++;
+        if (c >= end || *c != ',') {
+            break;
+        }
+        c++;
+    }
+    if (c >= end || *c++ != '\t') {
+        return 0;
+    }
+    for (int i = 0; i < num_notes; i++) {
+        int pc = parse_log_note(&c, end, NULL);
+        if (pc < 0 || (i + 1 < num_notes && (c >= end || *c++ != ','))) {
+            return 0;
+        }
+        w->guessed_pc[first + i] = (uint8_t)pc;
+    }
+    if (c >= end || *c++ != '\t') {
+        return 0;
+    }
+    long response_ms = parse_log_integer(&c, end);
+    if (c >= end || *c++ != '\t' || c >= end || (*c != '0' && *c != '1')) {
+        return 0;
+    }
+
+    for (int i = 0; i < num_notes; i++) {
+        int n = first + i;
+        if (i == 0) {
+            w->interval_cell[n] = ANALYTICS_FIRST_NOTE;
+        } else {
+            int played = (w->played_pc[n] - w->played_pc[n - 1] + NUM_NOTES) % NUM_NOTES;
+            int guessed = (w->guessed_pc[n] - w->guessed_pc[n - 1] + NUM_NOTES) % NUM_NOTES;
+            w->interval_cell[n] = (uint8_t)(played * NUM_NOTES + guessed);
+        }
+    }
+    long bin = response_ms / ANALYTICS_RT_BIN_MS;
+    w->response_bin[w->batch_turns] = (uint16_t)(bin < ANALYTICS_RT_BINS - 1 ? bin : ANALYTICS_RT_BINS - 1);
+    w->correct[w->batch_turns] = *c == '1';
+    w->trend_bucket[w->batch_turns] = (uint8_t)((line - w->log) * (double)ANALYTICS_TREND_BUCKETS / w->log_size);
+    w->batch_turns++;
+    w->batch_notes += num_notes;
+
+    StudentTally* tally = student_table_find(&w->students, fnv1a(0xcbf29ce484222325ULL, student, student_length) | 1,
+                                             student, student_length);
+    if (tally != NULL) {
+        tally->turns++;
+        tally->correct += *c == '1';
+        tally->response_ms += response_ms;
+    }
+    return 1;
+}
 
-                break;
+static void* analytics_worker(void* arg) {
+    AnalyticsWorker* w = (AnalyticsWorker*)arg;
+    const char* log_end = w->log + w->log_size;
+    const char* line = w->log + w->begin;
+    while (line < w->log + w->end) {
+        const char* newline = memchr(line, '\n', log_end - line);
+        const char* end = newline != NULL ? newline : log_end;
+        if (end > line && line[0] != '#' && !analytics_parse_line(w, line, end)) {
+            w->malformed++;
+        }
+        if (w->batch_turns == ANALYTICS_BATCH) {
+            analytics_reduce_batch(w);
+        }
+        line = end + 1;
+    }
+    analytics_reduce_batch(w);
+    return NULL;
+}
+
+static int analytics_worker_init(AnalyticsWorker* w) {
+    memset(w, 0, sizeof(*w));
+    w->played_pc = malloc((size_t)ANALYTICS_BATCH * NUM_NOTES);
+    w->octave = malloc((size_t)ANALYTICS_BATCH * NUM_NOTES);
+    w->guessed_pc = malloc((size_t)ANALYTICS_BATCH * NUM_NOTES);
+    w->interval_cell = malloc((size_t)ANALYTICS_BATCH * NUM_NOTES);
+    w->response_bin = malloc(sizeof(uint16_t) * ANALYTICS_BATCH);
+    w->correct = malloc(ANALYTICS_BATCH);
+    w->trend_bucket = malloc(ANALYTICS_BATCH);
+    w->response_histogram = calloc(ANALYTICS_TREND_BUCKETS, sizeof(*w->response_histogram));
+    return w->played_pc != NULL && w->octave != NULL && w->guessed_pc != NULL && w->interval_cell != NULL
+           && w->response_bin != NULL && w->correct != NULL && w->trend_bucket != NULL && w->response_histogram != NULL;
+}
+
+static void analytics_worker_destroy(AnalyticsWorker* w) {
+    free(w->played_pc);
+    free(w->octave);
+    free(w->guessed_pc);
+    free(w->interval_cell);
+    free(w->response_bin);
+    free(w->correct);
+    free(w->trend_bucket);
+    free(w->response_histogram);
+    free(w->students.slots);
+}
+
+// Free the first count workers, including one whose init failed part way
+static void analytics_workers_destroy(AnalyticsWorker* workers, int count) {
+    for (int t = 0; t < count; t++) {
+        analytics_worker_destroy(&workers[t]);
+    }
+}
+
+// Response time (ms) at a percentile of a histogram, to bin resolution
+static double histogram_percentile(const uint64_t* histogram, uint64_t total, double percentile) {
+    if (total == 0) {
+        return 0.0;
+    }
+    uint64_t rank = (uint64_t)ceil(percentile / 100.0 * total);
+    uint64_t seen = 0;
+    for (int b = 0; b < ANALYTICS_RT_BINS; b++) {
+        seen += histogram[b];
+        if (seen >= rank && seen > 0) {
+            return (b + 0.5) * ANALYTICS_RT_BIN_MS;
+        }
+    }
+    return (ANALYTICS_RT_BINS - 0.5) * ANALYTICS_RT_BIN_MS;
+}
+
+static int compare_student_names(const void* a, const void* b) {
+    const StudentTally* x = (const StudentTally*)a;
+    const StudentTally* y = (const StudentTally*)b;
+    size_t length = x->name_length < y->name_length ? x->name_length : y->name_length;
+    int order = memcmp(x->name, y->name, length);
+    return order != 0 ? order : (x->name_length > y->name_length) - (x->name_length < y->name_length);
+}
+
+static double percent(double part, double whole) {
+    return whole > 0.0 ? 100.0 * part / whole : 0.0;
+}
+
+int run_analytics(const char* path, const char* student_filter) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) != 0 || info.st_size == 0) {
+        printf("Error: Could not read turn log %s\n", path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return 1;
+    }
+    size_t size = (size_t)info.st_size;
+    const char* log = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (log == MAP_FAILED) {
+        printf("Error: Could not map turn log %s\n", path);
+        return 1;
+    }
+    madvise((void*)log, size, MADV_SEQUENTIAL);
 
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = cpus < 1 ? 1 : (cpus > ANALYTICS_MAX_THREADS ? ANALYTICS_MAX_THREADS : (int)cpus);
+    if ((size_t)num_threads > size / 4096 + 1) {
+        num_threads = (int)(size / 4096 + 1);  // not worth a thread per few lines
+    }
+    static AnalyticsWorker workers[ANALYTICS_MAX_THREADS];
+    pthread_t threads[ANALYTICS_MAX_THREADS];
+    double start = monotonic_seconds();
+
+    // Each range starts just after a newline, so every line belongs to exactly one worker
+    size_t begin = 0;
+    int initialized = 0, started = 0;
+    for (int t = 0; t < num_threads; t++) {
+        AnalyticsWorker* w = &workers[t];
+        initialized++;
+        if (!analytics_worker_init(w)) {
+            printf("Error: Could not allocate analytics buffers\n");
+            break;
+        }
+        size_t end = t + 1 == num_threads ? size : size / num_threads * (t + 1);
+        while (end < size && log[end - 1] != '\n') {
+            end++;
+        }
+        w->log = log;
+        w->log_size = size;
+        w->begin = begin;
+        w->end = end;
+        w->student_filter = student_filter;
+        begin = end;
+        if (pthread_create(&threads[t], NULL, analytics_worker, w) != 0) {
+            printf("Error: Could not start analytics thread\n");
+            break;
+        }
+        started++;
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    if (started < num_threads) {
+        analytics_workers_destroy(workers, initialized);
+        munmap((void*)log, size);
+        return 1;
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    // Sum the workers
+    long turns = 0, notes = 0, malformed = 0;
+    uint64_t pc_confusion[NUM_NOTES * NUM_NOTES] = {0};
+    uint64_t interval_confusion[ANALYTICS_INTERVAL_CELLS] = {0};
+    uint64_t octave_notes[NUM_OCTAVES] = {0}, octave_correct[NUM_OCTAVES] = {0};
+    uint64_t trend_turns[ANALYTICS_TREND_BUCKETS] = {0}, trend_correct[ANALYTICS_TREND_BUCKETS] = {0};
+    uint64_t (*histogram)[ANALYTICS_RT_BINS] = calloc(ANALYTICS_TREND_BUCKETS + 1, sizeof(*histogram));
+    uint64_t* overall = histogram[ANALYTICS_TREND_BUCKETS];
+    StudentTable students = {0};
+    for (int t = 0; t < num_threads; t++) {
+        AnalyticsWorker* w = &workers[t];
+        turns += w->turns;
+        notes += w->notes;
+        malformed += w->malformed;
+        for (int i = 0; i < NUM_NOTES * NUM_NOTES; i++) {
+            pc_confusion[i] += w->pc_confusion[i];
+        }
+        for (int i = 0; i < ANALYTICS_INTERVAL_CELLS; i++) {
+            interval_confusion[i] += w->interval_confusion[i];
+        }
+        for (int o = 0; o < NUM_OCTAVES; o++) {
+            octave_notes[o] += w->octave_notes[o];
+            octave_correct[o] += w->octave_correct[o];
+        }
+        for (int b = 0; b < ANALYTICS_TREND_BUCKETS; b++) {
+            trend_turns[b] += w->trend_turns[b];
+            trend_correct[b] += w->trend_correct[b];
+            for (int r = 0; r < ANALYTICS_RT_BINS && histogram != NULL; r++) {
+                histogram[b][r] += w->response_histogram[b][r];
+                overall[r] += w->response_histogram[b][r];
+            }
+        }
+        for (size_t i = 0; i < w->students.capacity; i++) {
+            const StudentTally* from = &w->students.slots[i];
+            StudentTally* into = from->hash != 0 ? student_table_find(&students, from->hash, from->name, from->name_length)
+                                                 : NULL;
+            if (into != NULL) {
+                into->turns += from->turns;
+                into->correct += from->correct;
+                into->response_ms += from->response_ms;
             }
+        }
+    }
+    analytics_workers_destroy(workers, num_threads);
+
+    printf("Turn log %s: %ld turns, %ld notes, %zu student(s)", path, turns, notes, students.count);
+    if (malformed > 0) {
+        printf(", %ld malformed line(s) skipped", malformed);
+    }
+    printf("\n  scanned %.1f MB in %.3f s on %d thread(s) (%.0f MB/s)\n", size / 1e6, elapsed, num_threads,
+           elapsed > 0.0 ? size / 1e6 / elapsed : 0.0);
+    if (turns == 0 || histogram == NULL) {
+        free(histogram);
+        free(students.slots);
+        munmap((void*)log, size);
+        return turns == 0 ? 0 : 1;
+    }
 
+    // Students, by name
+    size_t num_students = 0;
+    for (size_t i = 0; i < students.capacity; i++) {
+        if (students.slots[i].hash != 0) {
+            students.slots[num_students++] = students.slots[i];
         }
+    }
+    qsort(students.slots, num_students, sizeof(StudentTally), compare_student_names);
+    printf("\nStudents\n  %-24s %8s %9s %14s\n", "student", "turns", "accuracy", "mean response");
+    for (size_t i = 0; i < num_students; i++) {
+        const StudentTally* s = &students.slots[i];
+        printf("  %-24.*s %8ld %8.1f%% %11.0f ms\n", (int)s->name_length, s->name, s->turns,
+               percent(s->correct, s->turns), s->turns > 0 ? s->response_ms / s->turns : 0.0);
+    }
 
-        if (root_pitch_class == -1) {
+    printf("\nNote accuracy by octave\n");
+    for (int o = 0; o < NUM_OCTAVES; o++) {
+        if (octave_notes[o] > 0) {
+            printf("  octave %d: %10llu notes %6.1f%%\n", o, (unsigned long long)octave_notes[o],
+                   percent(octave_correct[o], octave_notes[o]));
+        }
+    }
 
-            printf("Warning: Could not find pitch class for scale root '%s'\n", scales[s]);
+    printf("\nPitch-class confusion (rows played, columns guessed, %% of row)\n     ");
+    for (int g = 0; g < NUM_NOTES; g++) {
+        printf("%6s", ce_note_names[g]);
+    }
+    printf("\n");
+    for (int p = 0; p < NUM_NOTES; p++) {
+        uint64_t row = 0;
+        for (int g = 0; g < NUM_NOTES; g++) {
+            row += pc_confusion[p * NUM_NOTES + g];
+        }
+        printf("  %-3s", ce_note_names[p]);
+        for (int g = 0; g < NUM_NOTES; g++) {
+            printf("%6.1f", percent(pc_confusion[p * NUM_NOTES + g], row));
+        }
+        printf("\n");
+    }
 
-            continue;
+    // The most frequent interval mistakes, as a share of how often that interval was played
+    printf("\nMost confused intervals (between consecutive notes)\n");
+    uint64_t interval_played[NUM_NOTES] = {0};
+    for (int cell = 0; cell < NUM_NOTES * NUM_NOTES; cell++) {
+        interval_played[cell / NUM_NOTES] += interval_confusion[cell];
+    }
+    int shown[NUM_NOTES * NUM_NOTES] = {0};
+    for (int rank = 0; rank < 10; rank++) {
+        int best = -1;
+        for (int cell = 0; cell < NUM_NOTES * NUM_NOTES; cell++) {
+            if (cell / NUM_NOTES != cell % NUM_NOTES && !shown[cell] && interval_confusion[cell] > 0
+                && (best < 0 || interval_confusion[cell] > interval_confusion[best])) {
+                best = cell;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        shown[best] = 1;
+        printf("  %-12s heard as %-12s %6.1f%% (%llu)\n", interval_names[best / NUM_NOTES], interval_names[best % NUM_NOTES],
+               percent(interval_confusion[best], interval_played[best / NUM_NOTES]),
+               (unsigned long long)interval_confusion[best]);
+    }
 
+    printf("\nResponse time: p50 %.0f ms | p90 %.0f ms | p99 %.0f ms\n", histogram_percentile(overall, turns, 50),
+           histogram_percentile(overall, turns, 90), histogram_percentile(overall, turns, 99));
+
+    printf("\nTrend (tenths of the log, oldest first)\n");
+    for (int b = 0; b < ANALYTICS_TREND_BUCKETS; b++) {
+        if (trend_turns[b] > 0) {
+            printf("  %2d: %10llu turns %6.1f%% correct, median response %6.0f ms\n", b + 1,
+                   (unsigned long long)trend_turns[b], percent(trend_correct[b], trend_turns[b]),
+                   histogram_percentile(histogram[b], trend_turns[b], 50));
         }
+    }
+
+    free(histogram);
+    free(students.slots);
+    munmap((void*)log, size);
+    return 0;
+}
 
+// --- Latency self-test ---
+// Plays a series of clicks through the output bus and measures, on the stream clock, how
+// long each takes from being requested and from being rendered in the callback until it
+// reaches the DAC, including the limiter's look-ahead.
 
+#define LATENCY_TEST_CLICKS 20
+#define LATENCY_TEST_CLICK_FRAMES 48
 
-        //printf("Building major scale for root: %s (pitch class %d)\n", scales[s], root_pitch_class);
+typedef struct {
+    atomic_int trigger;            // set by the main thread to request a click
+    double requested_time;         // stream time of the request
+    int count;
+    double render_to_output[LATENCY_TEST_CLICKS];
+    double request_to_output[LATENCY_TEST_CLICKS];
+    atomic_int done;
+} LatencyTest;
+
+static int latency_test_callback(const void* input, void* output, unsigned long framesPerBuffer,
+                                 const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) {
+    rt_prepare_callback_thread();
+    RT_CALLBACK_ENTER();
+    latency_note_status(statusFlags);
+    LatencyTest* test = (LatencyTest*)userData;
+    float* out = (float*)output;
+    memset(out, 0, framesPerBuffer * sizeof(float));
 
+    if (atomic_load_explicit(&test->trigger, memory_order_acquire) && test->count < LATENCY_TEST_CLICKS) {
+        for (unsigned long i = 0; i < framesPerBuffer && i < LATENCY_TEST_CLICK_FRAMES; i++) {
+            out[i] = 0.5f;
+        }
+        // The limiter holds the click back by its look-ahead before the DAC sees it
+        double click_dac_time = timeInfo->outputBufferDacTime + (double)LIMITER_LATENCY_FRAMES / SAMPLE_RATE;
+        test->render_to_output[test->count] = click_dac_time - timeInfo->currentTime;
+        test->request_to_output[test->count] = click_dac_time - test->requested_time;
+        test->count++;
+        atomic_store_explicit(&test->trigger, 0, memory_order_release);
+        if (test->count == LATENCY_TEST_CLICKS) {
+            atomic_store(&test->done, 1);
+        }
+    }
+    output_bus_process(out, framesPerBuffer);
+    RT_CALLBACK_EXIT();
+    return paContinue;
+}
 
+static void print_latency_row(const char* label, const double* values, int count) {
+    double low = values[0], high = values[0], total = 0.0;
+    for (int i = 0; i < count; i++) {
+        low = values[i] < low ? values[i] : low;
+        high = values[i] > high ? values[i] : high;
+        total += values[i];
+    }
+    printf("  %-18s min %6.2f ms | mean %6.2f ms | max %6.2f ms\n", label, low * 1000.0, total / count * 1000.0, high * 1000.0);
+}
 
-        int current_pitch_class = root_pitch_class;
+int run_latency_test(void) {
+    static LatencyTest test;
+    PaStream* stream;
 
-        for (int i = 0; i < 7; i++) {
+    Pa_Initialize();
+    if (open_output_stream(&stream, latency_test_callback, &test) != paNoError) {
+        printf("Error: Could not open an output stream\n");
+        Pa_Terminate();
+        return 1;
+    }
+    const PaStreamInfo* info = Pa_GetStreamInfo(stream);
+    printf("Latency self-test: %lu frames per buffer, reported output latency %.2f ms + %.2f ms limiter look-ahead\n",
+           latency.target_ms > 0.0 ? latency.frames_per_buffer : DEFAULT_FRAMES_PER_BUFFER,
+           info != NULL ? info->outputLatency * 1000.0 : 0.0, limiter_latency_ms());
+    Pa_StartStream(stream);
 
-            allowed_pitch_classes[current_pitch_class] = 1;
+    for (int click = 0; click < LATENCY_TEST_CLICKS && !atomic_load(&test.done); click++) {
+        Pa_Sleep(100);
+        test.requested_time = Pa_GetStreamTime(stream);
+        atomic_store_explicit(&test.trigger, 1, memory_order_release);
+        for (int waited = 0; atomic_load_explicit(&test.trigger, memory_order_acquire) && waited < 1000; waited++) {
+            Pa_Sleep(1);
+        }
+    }
 
-            //printf("  Allowing pitch class %d (%s)\n", current_pitch_class, note_names[current_pitch_class]);
+    Pa_StopStream(stream);
+    Pa_CloseStream(stream);
+    Pa_Terminate();
 
-            current_pitch_class = (current_pitch_class + major_scale_intervals[i]) % NUM_NOTES;
+    if (test.count == 0) {
+        printf("Error: No clicks were rendered\n");
+        return 1;
+    }
+    print_latency_row("render -> output", test.render_to_output, test.count);
+    print_latency_row("request -> output", test.request_to_output, test.count);
+    printf("  underruns: %d\n", atomic_load(&latency.underruns));
+    latency_adapt();
+    return 0;
+}
 
+// --- Self-tests ---
+// Standalone checks run with -selftest <name>; each prints a report and returns 0 on pass.
+
+#define ALIAS_FFT_SIZE 16384
+#define ALIAS_OVERSAMPLING 16
+#define ALIAS_FIR_TAPS 511
+
+// Fraction of power outside the harmonics of 'fundamental', in dB
+double alias_energy_db(const float* signal, double fundamental, const FftPlan* plan, Complex* work) {
+    for (int i = 0; i < ALIAS_FFT_SIZE; i++) {
+        // 4-term Blackman-Harris window: sidelobes below -92 dB
+        double x = 2.0 * M_PI * i / ALIAS_FFT_SIZE;
+        double window = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+        work[i].re = (float)(signal[i] * window);
+        work[i].im = 0.0f;
+    }
+    fft_execute(plan, work, 0);
+
+    double bin_hz = (double)SAMPLE_RATE / ALIAS_FFT_SIZE;
+    double total = 0.0, alias = 0.0;
+    for (int bin = 8; bin < ALIAS_FFT_SIZE / 2; bin++) {
+        double power = (double)work[bin].re * work[bin].re + (double)work[bin].im * work[bin].im;
+        double harmonic = floor(bin * bin_hz / fundamental + 0.5);
+        double distance = fabs(bin * bin_hz - harmonic * fundamental) / bin_hz;
+        total += power;
+        if (harmonic < 1.0 || distance > 6.0) {
+            alias += power;
         }
+    }
+    return 10.0 * log10(alias / total + 1e-30);
+}
 
+static float naive_waveform(int timbre, double t) {
+    if (timbre == TIMBRE_SAW) {
+        return (float)(2.0 * t - 1.0);
+    } else if (timbre == TIMBRE_SQUARE) {
+        return t < 0.5 ? 1.0f : -1.0f;
     }
+    return (float)(2.0 * fabs(2.0 * t - 1.0) - 1.0);
+}
 
+// Naive waveform rendered at 16x and decimated through a windowed-sinc low-pass
+void render_oversampled_reference(int timbre, double frequency, float* out, int length) {
+    static double taps[ALIAS_FIR_TAPS];
+    double cutoff = 0.45 / ALIAS_OVERSAMPLING;  // of the oversampled rate
+    double tap_sum = 0.0;
+    for (int k = 0; k < ALIAS_FIR_TAPS; k++) {
+        double m = k - (ALIAS_FIR_TAPS - 1) / 2.0;
+        double sinc = m == 0.0 ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * m) / (M_PI * m);
+        double x = 2.0 * M_PI * k / (ALIAS_FIR_TAPS - 1);
+        taps[k] = sinc * (0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x));
+        tap_sum += taps[k];
+    }
+    double increment = frequency / (SAMPLE_RATE * ALIAS_OVERSAMPLING);
+    for (int i = 0; i < length; i++) {
+        double acc = 0.0;
+        double t = fmod((double)i * ALIAS_OVERSAMPLING * increment, 1.0);
+        for (int k = 0; k < ALIAS_FIR_TAPS; k++) {
+            acc += taps[k] * naive_waveform(timbre, t);
+            t += increment;
+            t -= t >= 1.0 ? 1.0 : 0.0;
+        }
+        out[i] = (float)(acc / tap_sum);
+    }
 }
 
+// Compare PolyBLEP/PolyBLAMP aliasing against the naive waveform and an oversampled reference
+int selftest_alias(void) {
+    const int test_notes[][2] = {{9, 3}, {9, 5}, {0, 7}, {9, 7}, {0, 8}, {7, 8}};  // pitch class, octave
+    const int num_test_notes = sizeof(test_notes) / sizeof(test_notes[0]);
+    const float unity = 1.0f;
+    // How far above the 16x reference each timbre may alias, in dB: the worst measured gap
+    // over the test notes plus 3 dB. The two-sample residuals cannot cancel the first images
+    // just above Nyquist, which the reference's 511-tap filter removes. The gap is widest for
+    // the triangle because its reference is almost alias-free (below -69 dB).
+    const double reference_margin_db[CE_NUM_TIMBRES] = {
+        [TIMBRE_SAW] = 19.0,
+        [TIMBRE_SQUARE] = 19.0,
+        [TIMBRE_TRIANGLE] = 46.0,
+    };
+    FftPlan plan;
+    float* signal = malloc(sizeof(float) * ALIAS_FFT_SIZE);
+    Complex* work = malloc(sizeof(Complex) * ALIAS_FFT_SIZE);
+    if (signal == NULL || work == NULL || !fft_plan_init(&plan, ALIAS_FFT_SIZE)) {
+        printf("Error: Could not allocate self-test buffers\n");
+        return 1;
+    }
+
+    int failures = 0;
+    printf("Alias energy (dB relative to total power; lower is cleaner)\n");
+    printf("  %-8s %10s %8s %8s %8s\n", "timbre", "frequency", "naive", "blep", "16x ref");
+    for (int timbre = TIMBRE_SAW; timbre <= TIMBRE_TRIANGLE; timbre++) {
+        for (int n = 0; n < num_test_notes; n++) {
+            double frequency = pitch_class_frequency(test_notes[n][0], test_notes[n][1]);
+            double increment = frequency / SAMPLE_RATE;
+
+            for (int i = 0; i < ALIAS_FFT_SIZE; i++) {
+                signal[i] = naive_waveform(timbre, fmod(i * increment, 1.0));
+            }
+            double naive_db = alias_energy_db(signal, frequency, &plan, work);
+
+            memset(signal, 0, sizeof(float) * ALIAS_FFT_SIZE);
+            ce_render_voices(&frequency, &unity, 1, timbre, SAMPLE_RATE, 0, signal, ALIAS_FFT_SIZE, NULL);
+            double blep_db = alias_energy_db(signal, frequency, &plan, work);
 
+            render_oversampled_reference(timbre, frequency, signal, ALIAS_FFT_SIZE);
+            double reference_db = alias_energy_db(signal, frequency, &plan, work);
+
+            // Must clearly beat the naive waveform wherever there is aliasing to remove, and
+            // stay within the timbre's margin of the oversampled reference
+            int pass = blep_db <= naive_db - 6.0 && blep_db <= reference_db + reference_margin_db[timbre];
+            failures += !pass;
+            printf("  %-8s %8.1f Hz %8.1f %8.1f %8.1f %s\n", ce_timbre_names[timbre], frequency,
+                   naive_db, blep_db, reference_db, pass ? "" : "FAIL");
+        }
+    }
 
-// Function to filter notes based on an octave range
+    // Cost per voice-sample against the sine path
+    Note chord[NUM_NOTES];
+    for (int v = 0; v < NUM_NOTES; v++) {
+        chord[v] = (Note){ .step = v, .pitch_class = v, .octave = 4, .frequency = pitch_class_frequency(v, 4) };
+    }
+    AudioData* audio = malloc(sizeof(AudioData));
+    printf("Render cost, %d voices:\n", NUM_NOTES);
+    int saved_timbre = current_timbre;
+    for (int timbre = 0; timbre < CE_NUM_TIMBRES && audio != NULL; timbre++) {
+        set_timbre(timbre);
+        double started = monotonic_seconds();
+        generate_wavetable(chord, NUM_NOTES, audio);
+        double elapsed = monotonic_seconds() - started;
+        printf("  %-8s %6.2f ns per voice-sample\n", ce_timbre_names[timbre], elapsed * 1e9 / ((double)NUM_NOTES * BUFFER_SIZE));
+    }
+    set_timbre(saved_timbre);
+
+    free(audio);
+    free(signal);
+    free(work);
+    fft_plan_destroy(&plan);
+    printf("%s\n", failures == 0 ? "alias: PASS" : "alias: FAIL");
+    return failures == 0 ? 0 : 1;
+}
 
-void filter_notes_by_range(Note* notes, int* num_notes, int range_low, int range_high) {
+// Golden-audio regression: a fixed set of seeded chords is rendered offline through
+// generate_wavetable and the audio callback, and each result is reduced to a fingerprint
+// (its strongest spectral peaks, RMS and peak level) that must match the stored golden.
+// The goldens are for the default tuning, A reference, loudness and pluck controls, which
+// the test sets up itself. After an intended change to the sound, print new goldens with
+// -selftest golden-update and paste them over golden_fingerprints.
+
+#define GOLDEN_FFT_SIZE 65536                 // 1.4 s; 0.73 Hz bins resolve octave 0
+#define GOLDEN_SKIP_FRAMES (SAMPLE_RATE / 4)  // past the attack and the limiter's look-ahead
+#define GOLDEN_CALLBACK_FRAMES 256
+#define GOLDEN_MAX_PEAKS 6
+#define GOLDEN_PEAK_FLOOR_DB 40.0             // weaker peaks, relative to the strongest, are ignored
+#define GOLDEN_CENTS_TOLERANCE 1.0
+#define GOLDEN_LEVEL_TOLERANCE_DB 0.1
 
-    int filtered_count = 0;
+typedef struct {
+    int timbre;
+    int num_notes;
+    uint32_t seed;                        // picks the chord
+    double rms_db;                        // dBFS over the whole chord
+    double peak_db;
+    int num_peaks;
+    double peak_hz[GOLDEN_MAX_PEAKS];     // the strongest peaks, low to high
+} GoldenFingerprint;
+
+static const GoldenFingerprint golden_fingerprints[] = {
+    { TIMBRE_SINE, 1, 11, -6.93, -3.92, 1, { 1244.510 } },  // D#5
+    { TIMBRE_SINE, 3, 23, -7.69, -1.00, 3, { 369.996, 4698.638, 12543.853 } },  // F#3 G8 D7
+    { TIMBRE_SINE, 6, 37, -8.66, -1.00, 6, { 77.784, 932.327, 3135.961, 5919.909, 8869.847, 15804.267 } },  // D#1 C#8 B8 A#4 F#7 G6
+    { TIMBRE_SAW, 1, 111, -6.34, -1.61, 1, { 349.226 } },  // F3
+    { TIMBRE_SAW, 3, 123, -7.50, -1.00, 3, { 32.702, 184.996, 14079.999 } },  // C0 F#2 A8
+    { TIMBRE_SAW, 6, 137, -9.74, -1.00, 6, { 1760.001, 1864.653, 2217.459, 4698.638, 11175.304, 22350.607 } },  // A5 E6 F8 A#5 C#6 D7
+    { TIMBRE_SQUARE, 1, 211, -2.98, -1.00, 1, { 9397.274 } },  // D8
+    { TIMBRE_SQUARE, 3, 223, -4.90, -1.00, 3, { 110.002, 116.543, 349.626 } },  // A#1 C6 A1
+    { TIMBRE_SQUARE, 6, 237, -7.78, -1.00, 6, { 34.658, 123.473, 207.651, 370.411, 1567.980, 9956.066 } },  // B1 G#2 C#0 D#8 G5 F#4
+    { TIMBRE_TRIANGLE, 1, 311, -12.80, -8.86, 1, { 4186.011 } },  // C7
+    { TIMBRE_TRIANGLE, 3, 323, -7.45, -1.00, 3, { 103.824, 261.627, 1975.536 } },  // B5 C3 G#1
+    { TIMBRE_TRIANGLE, 6, 337, -7.08, -1.00, 6, { 98.002, 103.826, 123.466, 233.085, 1244.510, 2349.317 } },  // G#1 A#2 G1 D#5 B1 D6
+    { TIMBRE_PLUCK, 1, 411, -21.78, -1.00, 1, { 1107.138 } },  // A#0
+    { TIMBRE_PLUCK, 3, 423, -23.37, -1.00, 3, { 453.237, 523.252, 880.000 } },  // A2 E0 C4
+    { TIMBRE_PLUCK, 6, 437, -27.36, -1.00, 6, { 415.305, 987.766, 1567.980, 1759.999, 1864.654, 5919.909 } },  // A#5 B3 F#7 G5 A5 G#3
+};
 
-    for (int i = 0; i < *num_notes; i++) {
+typedef struct {
+    double frequency;
+    double level_db;
+} SpectralPeak;
+
+// num_notes distinct pitch classes anywhere in octaves 0-8, from the seed alone
+static void golden_chord(uint32_t seed, int num_notes, Note* chord) {
+    uint32_t rng = seed;
+    int used = 0;
+    for (int n = 0; n < num_notes;) {
+        int pitch_class = ce_random(&rng) % NUM_NOTES;
+        int octave = MIN_OCTAVE + ce_random(&rng) % NUM_OCTAVES;
+        if (used & (1 << pitch_class)) {
+            continue;
+        }
+        used |= 1 << pitch_class;
+        chord[n++] = (Note){ .step = pitch_class, .pitch_class = pitch_class, .octave = octave,
+                             .frequency = get_frequency(pitch_class, octave) };
+    }
+}
 
-        //printf("Filtering: Note %s (Octave %d)\n", notes[i].name, notes[i].octave);
+static int compare_peaks_by_level(const void* a, const void* b) {
+    double difference = ((const SpectralPeak*)b)->level_db - ((const SpectralPeak*)a)->level_db;
+    return (difference > 0.0) - (difference < 0.0);
+}
 
-        if (notes[i].octave >= range_low && notes[i].octave <= range_high) {
+static int compare_doubles(const void* a, const void* b) {
+    double difference = *(const double*)a - *(const double*)b;
+    return (difference > 0.0) - (difference < 0.0);
+}
 
-            //printf("  Keeping note %s octave %d\n", notes[i].name, notes[i].octave);
+// Local maxima of the windowed spectrum within GOLDEN_PEAK_FLOOR_DB of the strongest,
+// strongest first, at parabolically interpolated frequencies. Returns how many.
+static int golden_peaks(const float* signal, const FftPlan* plan, Complex* work, double* level_db, SpectralPeak* peaks) {
+    for (int i = 0; i < GOLDEN_FFT_SIZE; i++) {
+        double x = 2.0 * M_PI * i / GOLDEN_FFT_SIZE;
+        double window = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x);
+        work[i].re = (float)(signal[i] * window);
+        work[i].im = 0.0f;
+    }
+    fft_execute(plan, work, 0);
+    double strongest = -400.0;
+    for (int bin = 0; bin < GOLDEN_FFT_SIZE / 2; bin++) {
+        double power = (double)work[bin].re * work[bin].re + (double)work[bin].im * work[bin].im;
+        level_db[bin] = 10.0 * log10(power + 1e-30);
+        strongest = level_db[bin] > strongest ? level_db[bin] : strongest;
+    }
 
-            notes[filtered_count++] = notes[i];
+    // The window's main lobe is 8 bins wide, so a peak must top its 3 neighbours each side
+    double bin_hz = (double)SAMPLE_RATE / GOLDEN_FFT_SIZE;
+    int count = 0;
+    for (int bin = 4; bin < GOLDEN_FFT_SIZE / 2 - 4; bin++) {
+        int is_peak = level_db[bin] >= strongest - GOLDEN_PEAK_FLOOR_DB;
+        for (int k = 1; k <= 3 && is_peak; k++) {
+            is_peak = level_db[bin] > level_db[bin - k] && level_db[bin] >= level_db[bin + k];
+        }
+        if (is_peak) {
+            double a = level_db[bin - 1], b = level_db[bin], c = level_db[bin + 1];
+            double offset = 0.5 * (a - c) / (a - 2.0 * b + c);
+            peaks[count++] = (SpectralPeak){ (bin + offset) * bin_hz, b };
+        }
+    }
+    qsort(peaks, count, sizeof(SpectralPeak), compare_peaks_by_level);
+    return count;
+}
 
-        } else {
+// Distance in cents from frequency to the nearest of the candidates
+static double nearest_cents(double frequency, const double* candidates, int count, double* nearest) {
+    double best = 1e9;
+    for (int i = 0; i < count; i++) {
+        double cents = 1200.0 * log2(candidates[i] / frequency);
+        if (fabs(cents) < fabs(best)) {
+            best = cents;
+            *nearest = candidates[i];
+        }
+    }
+    return best;
+}
+
+// Check every chord against its golden, or with update set print new goldens as C
+int selftest_golden(int update) {
+    const int num_cases = sizeof(golden_fingerprints) / sizeof(golden_fingerprints[0]);
+    AudioData* audio = malloc(sizeof(AudioData));
+    float* output = malloc(sizeof(float) * BUFFER_SIZE);
+    Complex* work = malloc(sizeof(Complex) * GOLDEN_FFT_SIZE);
+    double* level_db = malloc(sizeof(double) * GOLDEN_FFT_SIZE / 2);
+    SpectralPeak* peaks = malloc(sizeof(SpectralPeak) * GOLDEN_FFT_SIZE / 8);
+    double* found_hz = malloc(sizeof(double) * GOLDEN_FFT_SIZE / 8);
+    FftPlan plan;
+    if (audio == NULL || output == NULL || work == NULL || level_db == NULL || peaks == NULL || found_hz == NULL
+        || !fft_plan_init(&plan, GOLDEN_FFT_SIZE)) {
+        printf("Error: Could not allocate self-test buffers\n");
+        return 1;
+    }
+
+    char error[256];
+    if (!set_tuning("equal", 0, CE_DEFAULT_A4, error, sizeof(error))) {
+        printf("Error: %s\n", error);
+        return 1;
+    }
+    set_loudness(DEFAULT_LOUDNESS_PHON);
+    set_pluck((CePluck){ CE_DEFAULT_PLUCK_DAMPING, CE_DEFAULT_PLUCK_BRIGHTNESS });
+
+    int failures = 0;
+    double started = monotonic_seconds();
+    if (update) {
+        printf("static const GoldenFingerprint golden_fingerprints[] = {\n");
+    } else {
+        printf("Golden fingerprints (peaks within %.1f cents, levels within %.2f dB)\n", GOLDEN_CENTS_TOLERANCE,
+               GOLDEN_LEVEL_TOLERANCE_DB);
+        printf("  %-8s %-28s %8s %8s %6s\n", "timbre", "chord", "rms dB", "peak dB", "peaks");
+    }
+    for (int c = 0; c < num_cases; c++) {
+        const GoldenFingerprint* golden = &golden_fingerprints[c];
+        Note chord[NUM_NOTES];
+        golden_chord(golden->seed, golden->num_notes, chord);
+        char chord_name[64] = "";
+        for (int n = 0; n < golden->num_notes; n++) {
+            char note[8];
+            snprintf(note, sizeof(note), "%s%s%d", n > 0 ? " " : "", ce_note_names[chord[n].pitch_class], chord[n].octave);
+            strncat(chord_name, note, sizeof(chord_name) - strlen(chord_name) - 1);
+        }
+
+        // The player hears the callback's output, limiter included
+        set_timbre(golden->timbre);
+        generate_wavetable(chord, golden->num_notes, audio);
+        limiter_reset(&limiter);
+        audio->index = 0;
+        for (int done = 0; done < BUFFER_SIZE; done += GOLDEN_CALLBACK_FRAMES) {
+            int frames = BUFFER_SIZE - done < GOLDEN_CALLBACK_FRAMES ? BUFFER_SIZE - done : GOLDEN_CALLBACK_FRAMES;
+            audio_callback(NULL, output + done, frames, NULL, 0, audio);
+        }
+
+        double square_sum = 0.0;
+        float peak = 0.0f;
+        for (int i = 0; i < BUFFER_SIZE; i++) {
+            square_sum += (double)output[i] * output[i];
+            peak = fmaxf(peak, fabsf(output[i]));
+        }
+        double rms_db = 10.0 * log10(square_sum / BUFFER_SIZE + 1e-30);
+        double peak_db = 20.0 * log10(peak + 1e-15);
+        int num_found = golden_peaks(output + GOLDEN_SKIP_FRAMES, &plan, work, level_db, peaks);
+        for (int i = 0; i < num_found; i++) {
+            found_hz[i] = peaks[i].frequency;
+        }
 
-            //printf("  Discarding note %s octave %d\n", notes[i].name, notes[i].octave);
+        if (update) {
+            int num_peaks = num_found < golden->num_notes ? num_found : golden->num_notes;
+            num_peaks = num_peaks > GOLDEN_MAX_PEAKS ? GOLDEN_MAX_PEAKS : num_peaks;
+            double strongest[GOLDEN_MAX_PEAKS];
+            memcpy(strongest, found_hz, sizeof(double) * num_peaks);
+            qsort(strongest, num_peaks, sizeof(double), compare_doubles);
+            char timbre[16];
+            snprintf(timbre, sizeof(timbre), "%s", ce_timbre_names[golden->timbre]);
+            for (char* letter = timbre; *letter != '\0'; letter++) {
+                *letter = (char)toupper((unsigned char)*letter);
+            }
+            printf("    { TIMBRE_%s, %d, %u, %.2f, %.2f, %d, {", timbre, golden->num_notes, golden->seed, rms_db, peak_db,
+                   num_peaks);
+            for (int i = 0; i < num_peaks; i++) {
+                printf("%s%.3f", i > 0 ? ", " : " ", strongest[i]);
+            }
+            printf(" } },  // %s\n", chord_name);
+            continue;
+        }
 
+        // Every golden peak must still be there, and the strongest peak must be a golden one
+        int matched = 0;
+        char detail[512] = "";
+        for (int i = 0; i < golden->num_peaks; i++) {
+            double nearest = 0.0;
+            double cents = nearest_cents(golden->peak_hz[i], found_hz, num_found, &nearest);
+            if (fabs(cents) <= GOLDEN_CENTS_TOLERANCE) {
+                matched++;
+            } else {
+                char line[128];
+                snprintf(line, sizeof(line), "    peak %.3f Hz missing (nearest %.3f Hz, %+.1f cents)\n",
+                         golden->peak_hz[i], nearest, cents);
+                strncat(detail, line, sizeof(detail) - strlen(detail) - 1);
+            }
         }
+        double nearest_golden = 0.0;
+        int strongest_ok = num_found > 0 && fabs(nearest_cents(found_hz[0], golden->peak_hz, golden->num_peaks,
+                                                               &nearest_golden)) <= GOLDEN_CENTS_TOLERANCE;
+        if (!strongest_ok) {
+            char line[128];
+            snprintf(line, sizeof(line), "    strongest peak %.3f Hz is not a golden peak\n", num_found > 0 ? found_hz[0] : 0.0);
+            strncat(detail, line, sizeof(detail) - strlen(detail) - 1);
+        }
+        int levels_ok = fabs(rms_db - golden->rms_db) <= GOLDEN_LEVEL_TOLERANCE_DB
+                        && fabs(peak_db - golden->peak_db) <= GOLDEN_LEVEL_TOLERANCE_DB;
+        if (!levels_ok) {
+            char line[128];
+            snprintf(line, sizeof(line), "    levels differ from the golden rms %.2f dB, peak %.2f dB\n", golden->rms_db,
+                     golden->peak_db);
+            strncat(detail, line, sizeof(detail) - strlen(detail) - 1);
+        }
+        int pass = matched == golden->num_peaks && strongest_ok && levels_ok;
+        failures += !pass;
+        printf("  %-8s %-28s %8.2f %8.2f %3d/%-2d %s\n", ce_timbre_names[golden->timbre], chord_name, rms_db, peak_db,
+               matched, golden->num_peaks, pass ? "" : "FAIL");
+        printf("%s", detail);
+    }
+    if (update) {
+        printf("};\n");
+    }
 
+    free(audio);
+    free(output);
+    free(work);
+    free(level_db);
+    free(peaks);
+    free(found_hz);
+    fft_plan_destroy(&plan);
+    if (!update) {
+        printf("%d chords in %.2f s\n", num_cases, monotonic_seconds() - started);
+        printf("%s\n", failures == 0 ? "golden: PASS" : "golden: FAIL");
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// A prefetched turn is played as rendered unless the timbre, pluck, tuning or loudness
+// changes after the worker has put it in the render cache. Each case runs the turn the way
+// the game loop does: take the prefetch, or fall back to render_cache_acquire. An unchanged
+// turn must play the prefetched render with no miss beyond the worker's own; a changed one
+// must miss and sound different from the render made with the old settings.
+int selftest_prefetch(void) {
+    const char* changes[] = {"none", "timbre", "pluck", "tuning", "loudness"};
+    const int num_changes = sizeof(changes) / sizeof(changes[0]);
+    int saved_headless = headless, saved_render = headless_render;
+    PresentationMode saved_mode = presentation_mode;
+    headless = 1;
+    headless_render = 1;
+    presentation_mode = PLAY_CHORD;
+    AudioData* stale = malloc(sizeof(AudioData));
+    if (stale == NULL) {
+        printf("Error: Could not allocate the reference render\n");
+        return 1;
     }
 
-    *num_notes = filtered_count;
+    int failures = 0;
+    char error[256];
+    printf("  %-10s %-9s %-7s %s\n", "change", "prefetch", "misses", "samples");
+    for (int c = 0; c < num_changes; c++) {
+        // Start every case from the same settings and an empty cache
+        if (!set_tuning("equal", 0, a4_frequency, error, sizeof(error))) {
+            printf("Error: %s\n", error);
+            failures++;
+            break;
+        }
+        if (!render_cache_init(&render_cache, 0)) {
+            failures++;
+            break;
+        }
+        set_loudness(DEFAULT_LOUDNESS_PHON);
+        set_pluck((CePluck){ CE_DEFAULT_PLUCK_DAMPING, CE_DEFAULT_PLUCK_BRIGHTNESS });
+        set_timbre(c == 2 ? TIMBRE_PLUCK : TIMBRE_SINE);
+        Note chord[3];
+        for (int n = 0; n < 3; n++) {
+            chord[n] = (Note){ .step = 4 * n, .pitch_class = 4 * n, .octave = 4, .frequency = pitch_class_frequency(4 * n, 4) };
+        }
+        generate_wavetable(chord, 3, stale);
+
+        // Let the worker finish and cache its render before the settings change
+        TurnPrefetch prefetch;
+        prefetch_init(&prefetch);
+        prefetch_start(&prefetch, chord, 3);
+        for (int wait = 0; wait < 5000 && prefetch.active && !atomic_load(&prefetch.ready); wait++) {
+            nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+        }
+        if (c == 1) {
+            set_timbre(TIMBRE_SAW);
+        } else if (c == 2) {
+            set_pluck((CePluck){ 1.0, current_pluck.brightness });
+        } else if (c == 3 && !set_tuning("just", 0, a4_frequency, error, sizeof(error))) {
+            printf("Error: %s\n", error);
+            failures++;
+        } else if (c == 4) {
+            set_loudness(0.0);
+        }
+        for (int n = 0; n < 3; n++) {
+            chord[n].frequency = pitch_class_frequency(chord[n].pitch_class, chord[n].octave);  // the next turn's notes
+        }
 
+        RenderCacheEntry* entry = NULL;
+        int used = prefetch_finish(&prefetch, &entry);
+        if (!used) {
+            entry = render_cache_acquire(&render_cache, chord, 3, NULL);
+        }
+        long misses = render_cache.misses;
+        int same = entry != NULL && memcmp(entry->audio->buffer, stale->buffer, sizeof(stale->buffer)) == 0;
+        int pass = c == 0 ? used && misses == 1 && same : !used && misses == 2 && entry != NULL && !same;
+        failures += !pass;
+        printf("  %-10s %-9s %-7ld %-9s %s\n", changes[c], used ? "played" : "discarded", misses,
+               same ? "same" : "different", pass ? "" : "FAIL");
+        render_cache_release(&render_cache, entry);
+        render_cache_destroy(&render_cache);
+    }
+
+    free(stale);
+    headless = saved_headless;
+    headless_render = saved_render;
+    presentation_mode = saved_mode;
+    printf("%s\n", failures == 0 ? "prefetch: PASS" : "prefetch: FAIL");
+    return failures == 0 ? 0 : 1;
 }
 
+// Render cache hits and misses: the same chord rendered twice hits, each sound setting
+// changed after it misses, and going back to the original settings hits again
+int selftest_cache(void) {
+    // Each row changes one setting from the row before it
+    const struct {
+        const char* name;
+        int timbre;
+        double damping;
+        const char* tuning;
+        double a4;
+        double phon;
+        int expect_hit;
+    } steps[] = {
+        {"first",    TIMBRE_SINE,  CE_DEFAULT_PLUCK_DAMPING, "equal", CE_DEFAULT_A4, DEFAULT_LOUDNESS_PHON, 0},
+        {"repeat",   TIMBRE_SINE,  CE_DEFAULT_PLUCK_DAMPING, "equal", CE_DEFAULT_A4, DEFAULT_LOUDNESS_PHON, 1},
+        {"timbre",   TIMBRE_PLUCK, CE_DEFAULT_PLUCK_DAMPING, "equal", CE_DEFAULT_A4, DEFAULT_LOUDNESS_PHON, 0},
+        {"pluck",    TIMBRE_PLUCK, 1.0,                      "equal", CE_DEFAULT_A4, DEFAULT_LOUDNESS_PHON, 0},
+        {"tuning",   TIMBRE_PLUCK, 1.0,                      "just",  CE_DEFAULT_A4, DEFAULT_LOUDNESS_PHON, 0},
+        {"a4",       TIMBRE_PLUCK, 1.0,                      "just",  432.0,         DEFAULT_LOUDNESS_PHON, 0},
+        {"loudness", TIMBRE_PLUCK, 1.0,                      "just",  432.0,         0.0,                   0},
+        {"restored", TIMBRE_SINE,  CE_DEFAULT_PLUCK_DAMPING, "equal", CE_DEFAULT_A4, DEFAULT_LOUDNESS_PHON, 1},
+    };
+    const int num_steps = sizeof(steps) / sizeof(steps[0]);
+    char error[256];
+    if (!render_cache_init(&render_cache, num_steps * sizeof(AudioData))) {  // room for every render
+        return 1;
+    }
 
+    int failures = 0;
+    printf("  %-10s %s\n", "render", "cache");
+    for (int s = 0; s < num_steps; s++) {
+        if (!set_tuning(steps[s].tuning, 0, steps[s].a4, error, sizeof(error))) {
+            printf("Error: %s\n", error);
+            failures++;
+            break;
+        }
+        set_timbre(steps[s].timbre);
+        set_pluck((CePluck){ steps[s].damping, CE_DEFAULT_PLUCK_BRIGHTNESS });
+        set_loudness(steps[s].phon);
 
-// Compare function for sorting by frequency
+        Note chord[3];
+        for (int n = 0; n < 3; n++) {
+            chord[n] = (Note){ .step = 4 * n, .pitch_class = 4 * n, .octave = 4, .frequency = pitch_class_frequency(4 * n, 4) };
+        }
+        long hits = render_cache.hits;
+        render_cache_release(&render_cache, render_cache_acquire(&render_cache, chord, 3, NULL));
+        int hit = render_cache.hits > hits;
+        int pass = hit == steps[s].expect_hit;
+        failures += !pass;
+        printf("  %-10s %-5s %s\n", steps[s].name, hit ? "hit" : "miss", pass ? "" : "FAIL");
+    }
+    print_render_cache_stats(&render_cache);
+    render_cache_destroy(&render_cache);
+    printf("%s\n", failures == 0 ? "cache: PASS" : "cache: FAIL");
+    return failures == 0 ? 0 : 1;
+}
 
-int compare_by_frequency(const void* a, const void* b) {
+// Tunings that are not 12-step, end to end: an edo:31 pool holds every step of each octave
+// at its equal-tempered pitch, guesses are parsed and judged by step number, and an edo:19
+// game judges a turn answered by step names
+static int tuning_check(const char* what, int pass) {
+    printf("  %-46s %s\n", what, pass ? "ok" : "FAIL");
+    return !pass;
+}
 
-    Note* note_a = (Note*)a;
+int selftest_tuning(void) {
+    CeTuning tuning;
+    char error[256];
+    if (!ce_tuning_load(&tuning, "edo:31", 0, a4_frequency, error, sizeof(error))) {
+        printf("Error: %s\n", error);
+        return 1;
+    }
+    const char* roots[] = {"C"};
+    CeNote pool[CE_MAX_POOL];
+    int size = ce_build_pool(&tuning, roots, 1, 3, 4, pool, CE_MAX_POOL, error, sizeof(error));
+    int failures = tuning_check("edo:31 pool has 31 steps in each of 2 octaves", size == 62);
+    int in_order = size == 62;
+    for (int i = 0; i < size && in_order; i++) {
+        char name[8];
+        snprintf(name, sizeof(name), "%d", i % 31);
+        in_order = pool[i].step == i % 31 && pool[i].octave == 3 + i / 31 && strcmp(pool[i].name, name) == 0
+                   && (i == 0 || fabs(pool[i].frequency / pool[i - 1].frequency - pow(2.0, 1.0 / 31)) < 1e-9);
+    }
+    failures += tuning_check("steps named, ordered and 1/31 octave apart", in_order);
+    failures += tuning_check("guesses parse as steps 0-30 only", ce_parse_step(&tuning, "30") == 30
+                             && ce_parse_step(&tuning, "31") == -1 && ce_parse_step(&tuning, "C#") == -1);
+    if (size == 62) {
+        CeNote answers[3] = {pool[5], pool[40], pool[60]};
+        int right[3] = {5, 9, 29}, wrong[3] = {5, 9, 28};
+        failures += tuning_check("ce_judge accepts the right steps", ce_judge(answers, right, 3));
+        failures += tuning_check("ce_judge rejects a neighbouring step", !ce_judge(answers, wrong, 3));
+    }
 
-    Note* note_b = (Note*)b;
+    // A whole edo:19 turn through the engine: right, then one step off
+    CeConfig config = { .scales = roots, .num_scales = 1, .notes_per_turn = 4, .range_low = 4, .range_high = 4,
+                        .turns = 2, .tuning = "edo:19", .a4_hz = a4_frequency, .timbre = TIMBRE_SINE, .seed = 1 };
+    ChordEngine* engine = ce_create(&config, error, sizeof(error));
+    if (engine == NULL) {
+        printf("Error: %s\n", error);
+        return 1;
+    }
+    int verdicts[2] = {-1, -1};
+    CeEvent event;
+    while (ce_step(engine, &event) && event.type == CE_EVENT_TURN_START) {
+        int count;
+        const CeNote* notes = ce_turn_notes(engine, &count);
+        for (int i = 0; i < count; i++) {
+            char guess[8];
+            int off = event.turn == 2 && i == count - 1;
+            snprintf(guess, sizeof(guess), "%d", (notes[i].step + off) % 19);
+            ce_input(engine, guess);
+        }
+        while (ce_step(engine, &event) && event.type != CE_EVENT_TURN_END) {
+        }
+        verdicts[event.turn - 1] = event.correct;
+    }
+    ce_destroy(engine);
+    failures += tuning_check("edo:19 turn guessed by step is correct", verdicts[0] == 1);
+    failures += tuning_check("edo:19 turn one step off is incorrect", verdicts[1] == 0);
 
-    if (note_a->frequency < note_b->frequency) {
+    printf("%s\n", failures == 0 ? "tuning: PASS" : "tuning: FAIL");
+    return failures == 0 ? 0 : 1;
+}
 
-        return -1;
+int run_selftest(const char* name) {
+    if (strcmp(name, "alias") == 0) {
+        return selftest_alias();
+    }
+    if (strcmp(name, "golden") == 0 || strcmp(name, "golden-update") == 0) {
+        return selftest_golden(strcmp(name, "golden-update") == 0);
+    }
+    if (strcmp(name, "prefetch") == 0) {
+        return selftest_prefetch();
+    }
+    if (strcmp(name, "tuning") == 0) {
+        return selftest_tuning();
+    }
+    if (strcmp(name, "cache") == 0) {
+        return selftest_cache();
+    }
+    printf("Error: Unknown self-test %s\n", name);
+    return 1;
+}
+
+// --- Benchmarks ---
+// Standalone measurements run with -bench <name>.
+
+// Cost of one reverb block against IR length, using synthetic exponentially decaying noise
+int bench_reverb(void) {
+    const double lengths[] = {0.25, 0.5, 1.0, 2.0, 3.0, 4.0, 5.0};
+    const int num_lengths = sizeof(lengths) / sizeof(lengths[0]);
+    const int blocks = 400;
+    static Reverb bench;
+    float* block = malloc(sizeof(float) * REVERB_BLOCK);
+    if (block == NULL) {
+        return 1;
+    }
+    unsigned int rng = 1;
+    double block_seconds = (double)REVERB_BLOCK / SAMPLE_RATE;
+
+    printf("Partitioned convolution, %d-frame blocks (%.2f ms)\n", REVERB_BLOCK, block_seconds * 1000.0);
+    printf("  %8s %10s %12s %12s %10s\n", "IR", "partitions", "mean us", "max us", "% of RT");
+    for (int l = 0; l < num_lengths; l++) {
+        int frames = (int)(lengths[l] * SAMPLE_RATE);
+        float* ir = malloc(sizeof(float) * frames);
+        if (ir == NULL) {
+            break;
+        }
+        for (int i = 0; i < frames; i++) {
+            ir[i] = ((float)rand_r(&rng) / RAND_MAX - 0.5f) * expf(-6.9f * i / frames);
+        }
+        if (!reverb_init(&bench, ir, frames, 0.5f)) {
+            free(ir);
+            break;
+        }
+        double total = 0.0, worst = 0.0;
+        for (int b = 0; b < blocks; b++) {
+            for (int i = 0; i < REVERB_BLOCK; i++) {
+                block[i] = (float)rand_r(&rng) / RAND_MAX - 0.5f;
+            }
+            double started = monotonic_seconds();
+            reverb_process(&bench, block, REVERB_BLOCK);
+            double elapsed = monotonic_seconds() - started;
+            total += elapsed;
+            worst = elapsed > worst ? elapsed : worst;
+        }
+        printf("  %6.2f s %10d %12.1f %12.1f %9.1f%%\n", lengths[l], bench.partitions, total / blocks * 1e6,
+               worst * 1e6, total / blocks / block_seconds * 100.0);
+        free(bench.ir_spectra);
+        free(bench.delay_line);
+        fft_plan_destroy(&bench.plan);
+        free(ir);
+    }
+    free(block);
+    return 0;
+}
+
+// Transport cost of the shared-memory ring. A forked process attaches to it by name like
+// an external mixer and drains it while the normal stream thread fills it, first
+// free-running for throughput, then on the sample clock for wake-up latency.
+
+#define SHM_BENCH_LATENCY_BINS 2000  // 10 us bins up to 20 ms
+#define SHM_BENCH_ATTACH_SECONDS 5.0
+
+typedef struct {
+    uint64_t blocks;
+    uint64_t frames;
+    double checksum;
+    uint64_t latency_histogram[SHM_BENCH_LATENCY_BINS + 1];
+} ShmBenchResult;
+
+typedef struct {
+    uint64_t frame;
+    uint64_t total_frames;
+} ShmBenchSource;
+
+static int shm_bench_callback(const void* input, void* output, unsigned long framesPerBuffer,
+                              const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) {
+    ShmBenchSource* source = (ShmBenchSource*)userData;
+    float* out = (float*)output;
+    for (unsigned long i = 0; i < framesPerBuffer; i++) {
+        out[i] = (float)((source->frame + i) & 1023) / 1024.0f;
+    }
+    source->frame += framesPerBuffer;
+    return source->frame >= source->total_frames ? paComplete : paContinue;
+}
+
+// Child side: consume until the producer is gone, then report through the pipe
+static void shm_bench_consume(const char* name, int result_fd) {
+    static ShmBenchResult result;
+    int fd = shm_open(name, O_RDWR, 0);
+    struct stat info;
+    ChordShmHeader* ring = MAP_FAILED;
+    if (fd != -1 && fstat(fd, &info) == 0) {
+        ring = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (ring == MAP_FAILED || ring->magic != CHORDSHM_MAGIC) {
+        _exit(1);
+    }
+    atomic_store(&ring->consumer_pid, (int32_t)getpid());
+
+    uint32_t read = atomic_load(&ring->read_index);
+    for (;;) {
+        uint32_t write = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+        if (read == write) {
+            if (atomic_load(&ring->producer_pid) == 0) {
+                break;
+            }
+            atomic_store(&ring->consumer_waiting, 1);
+            if (atomic_load(&ring->write_index) == read && atomic_load(&ring->producer_pid) != 0) {
+                futex_wait(&ring->write_index, read, 100000000L);
+            }
+            atomic_store(&ring->consumer_waiting, 0);
+            continue;
+        }
+        ChordShmSlot* slot = chordshm_slot(ring, read);
+        uint64_t latency_ns = monotonic_ns() - slot->publish_ns;
+        const float* samples = chordshm_samples(slot);
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < slot->frames; i++) {
+            sum += samples[i];
+        }
+        result.checksum += sum;
+        result.frames += slot->frames;
+        result.blocks++;
+        uint64_t bin = latency_ns / 10000;
+        result.latency_histogram[bin < SHM_BENCH_LATENCY_BINS ? bin : SHM_BENCH_LATENCY_BINS]++;
+
+        atomic_store(&ring->read_index, ++read);
+        if (atomic_load(&ring->producer_waiting)) {
+            futex_wake(&ring->read_index);
+        }
+    }
+    atomic_store(&ring->consumer_pid, 0);
+    ssize_t written = write(result_fd, &result, sizeof(result));
+    _exit(written == (ssize_t)sizeof(result) ? 0 : 1);
+}
+
+static double shm_bench_latency_us(const ShmBenchResult* result, double percentile) {
+    uint64_t target = (uint64_t)ceil(result->blocks * percentile);
+    uint64_t seen = 0;
+    for (int bin = 0; bin <= SHM_BENCH_LATENCY_BINS; bin++) {
+        seen += result->latency_histogram[bin];
+        if (seen >= target) {
+            return (bin + 1) * 10.0;
+        }
+    }
+    return SHM_BENCH_LATENCY_BINS * 10.0;
+}
+
+// One run: returns 0 and prints a row, or 1 on failure
+static int bench_shm_run(int frames_per_slot, double seconds_of_audio, int free_running) {
+    char name[64];
+    snprintf(name, sizeof(name), "/chordgame-bench-%d", (int)getpid());
+    if (!shm_output_create(name, frames_per_slot)) {
+        return 1;
+    }
+    shm_output.free_running = free_running;
 
-    } else if (note_a->frequency > note_b->frequency) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        shm_output_destroy();
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(pipe_fds[0]);
+        shm_bench_consume(name, pipe_fds[1]);
+    }
+    close(pipe_fds[1]);
+    if (child == -1) {
+        close(pipe_fds[0]);
+        shm_output_destroy();
+        return 1;
+    }
+    // The consumer may fail to attach or die before it does; never wait on it forever
+    double attach_deadline = monotonic_seconds() + SHM_BENCH_ATTACH_SECONDS;
+    while (atomic_load(&shm_output.ring->consumer_pid) == 0) {
+        if (waitpid(child, NULL, WNOHANG) == child || monotonic_seconds() > attach_deadline) {
+            printf("Error: Benchmark consumer did not attach to %s\n", name);
+            kill(child, SIGKILL);
+            waitpid(child, NULL, 0);
+            close(pipe_fds[0]);
+            shm_output_destroy();
+            return 1;
+        }
+        game_sleep(1);
+    }
 
+    ShmBenchSource source = { 0, (uint64_t)(seconds_of_audio * SAMPLE_RATE) };
+    OutputStream stream;
+    double started = monotonic_seconds();
+    output_open(&stream, shm_bench_callback, &source);
+    output_start(&stream);
+    while (output_is_active(&stream)) {
+        game_sleep(1);
+    }
+    output_close(&stream);
+    double elapsed = monotonic_seconds() - started;
+    uint64_t overruns = atomic_load(&shm_output.ring->overruns);
+    shm_output_destroy();
+
+    static ShmBenchResult result;
+    ssize_t got = read(pipe_fds[0], &result, sizeof(result));
+    close(pipe_fds[0]);
+    waitpid(child, NULL, 0);
+    if (got != (ssize_t)sizeof(result)) {
+        printf("Error: Benchmark consumer failed\n");
         return 1;
+    }
+    double megabytes = result.frames * sizeof(float) / 1e6;
+    printf("  %-6s %6d %10llu %10.1f %9.1fx %8.1f %8.1f %8.1f %8llu\n", free_running ? "free" : "paced", frames_per_slot,
+           (unsigned long long)result.blocks, megabytes / elapsed, result.frames / (elapsed * SAMPLE_RATE),
+           shm_bench_latency_us(&result, 0.5), shm_bench_latency_us(&result, 0.99),
+           shm_bench_latency_us(&result, 1.0), (unsigned long long)overruns);
+    return 0;
+}
+
+int bench_shm(void) {
+    static const int slot_sizes[] = {64, 256, 1024, 4096};
+    int num_sizes = sizeof(slot_sizes) / sizeof(slot_sizes[0]);
+    int failed = 0;
+
+    printf("Shared-memory ring, %d slots, forked consumer; latency is publish to read\n", SHM_SLOT_COUNT);
+    printf("  %-6s %6s %10s %10s %10s %8s %8s %8s %8s\n", "clock", "frames", "blocks", "MB/s", "realtime",
+           "p50 us", "p99 us", "max us", "dropped");
+    for (int s = 0; s < num_sizes && !failed; s++) {
+        failed = bench_shm_run(slot_sizes[s], 600.0, 1);
+    }
+    for (int s = 0; s < 2 && !failed; s++) {
+        failed = bench_shm_run(slot_sizes[s], 2.0, 0);
+    }
+    return failed;
+}
 
-    } else {
+// CPU the multi-rate path saves on chords of the game's length, spread over different
+// registers: each is rendered both ways (best of a few runs), and the multi-rate output is
+// compared sample by sample with the full-rate one, relative to its peak.
 
-        return 0;
+#define MULTIRATE_BENCH_RUNS 5
 
+typedef struct {
+    const char* name;
+    int low_octave;
+    int high_octave;
+    int voices;
+} MultirateBenchChord;
+
+static double bench_render_seconds(const double* frequencies, const float* amplitudes, int num_voices, int timbre,
+                                   int full_rate, float* buffer) {
+    double best = 0.0;
+    for (int run = 0; run < MULTIRATE_BENCH_RUNS; run++) {
+        memset(buffer, 0, sizeof(float) * BUFFER_SIZE);
+        double started = monotonic_seconds();
+        if (full_rate) {
+            ce_render_voices_full_rate(frequencies, amplitudes, num_voices, timbre, SAMPLE_RATE, 0, buffer, BUFFER_SIZE, NULL);
+        } else {
+            ce_render_voices(frequencies, amplitudes, num_voices, timbre, SAMPLE_RATE, 0, buffer, BUFFER_SIZE, NULL);
+        }
+        double elapsed = monotonic_seconds() - started;
+        best = run == 0 || elapsed < best ? elapsed : best;
     }
-
+    return best;
 }
 
+int bench_multirate(void) {
+    const MultirateBenchChord chords[] = {
+        {"wide", 0, 8, 12}, {"wide", 0, 8, 6}, {"low", 0, 2, 6}, {"middle", 3, 5, 6}, {"high", 6, 8, 6}
+    };
+    const int num_chords = sizeof(chords) / sizeof(chords[0]);
+    float* full = malloc(sizeof(float) * BUFFER_SIZE);
+    float* multirate = malloc(sizeof(float) * BUFFER_SIZE);
+    if (full == NULL || multirate == NULL) {
+        free(full);
+        free(multirate);
+        return 1;
+    }
 
+    // Only sine voices change rate; the other timbres take the full-rate path unchanged
+    printf("Multi-rate synthesis, %.0f s sine chords at %d Hz\n", (double)BUFFER_SIZE / SAMPLE_RATE, SAMPLE_RATE);
+    printf("  %-18s %8s %12s %12s %8s %10s\n", "chord", "reduced", "full ms", "multi ms", "saved", "diff dB");
+    for (int c = 0; c < num_chords; c++) {
+        const MultirateBenchChord* chord = &chords[c];
+        double frequencies[NUM_NOTES];
+        float amplitudes[NUM_NOTES];
+        int reduced = 0;
+        for (int v = 0; v < chord->voices; v++) {
+            int octave = chord->low_octave + v * (chord->high_octave - chord->low_octave) / (chord->voices - 1);
+            frequencies[v] = pitch_class_frequency(v * 7 % NUM_NOTES, octave);
+            amplitudes[v] = (float)ce_voice_amplitude(1.0, chord->voices);
+            reduced += ce_voice_rate_divisor(frequencies[v], TIMBRE_SINE, SAMPLE_RATE) > 1;
+        }
+        double full_seconds = bench_render_seconds(frequencies, amplitudes, chord->voices, TIMBRE_SINE, 1, full);
+        double multirate_seconds = bench_render_seconds(frequencies, amplitudes, chord->voices, TIMBRE_SINE, 0, multirate);
 
-// Function to remove duplicates from the list of notes
+        float peak = 0.0f, difference = 0.0f;
+        for (int i = 0; i < BUFFER_SIZE; i++) {
+            peak = fmaxf(peak, fabsf(full[i]));
+            difference = fmaxf(difference, fabsf(multirate[i] - full[i]));
+        }
+        char label[32], voices[16];
+        snprintf(label, sizeof(label), "%s %d x oct %d-%d", chord->name, chord->voices, chord->low_octave, chord->high_octave);
+        snprintf(voices, sizeof(voices), "%d/%d", reduced, chord->voices);
+        printf("  %-18s %8s %12.2f %12.2f %7.1f%% %10.1f\n", label, voices, full_seconds * 1e3, multirate_seconds * 1e3,
+               (1.0 - multirate_seconds / full_seconds) * 100.0, 20.0 * log10((difference + 1e-12) / peak));
+    }
+    free(full);
+    free(multirate);
+    return 0;
+}
 
-int remove_duplicates(Note* notes, int num_notes) {
+int run_bench(const char* name) {
+    if (strcmp(name, "reverb") == 0) {
+        return bench_reverb();
+    }
+    if (strcmp(name, "shm") == 0) {
+        return bench_shm();
+    }
+    if (strcmp(name, "multirate") == 0) {
+        return bench_multirate();
+    }
+    printf("Error: Unknown benchmark %s\n", name);
+    return 1;
+}
 
-    int unique_count = 0;
+// --- Main Game Logic ---
 
-    for (int i = 0; i < num_notes; i++) {
+int main(int argc, char* argv[]) {
 
-        int is_duplicate = 0;
+    int dev_null = open("/dev/null", O_WRONLY);
 
-        for (int j = 0; j < unique_count; j++) {
+    if (dev_null != -1) {
 
-            if (notes[i].pitch_class == notes[j].pitch_class && notes[i].octave == notes[j].octave) {
+        dup2(dev_null, STDERR_FILENO);  // Redirect stderr to /dev/null
 
-                is_duplicate = 1;
+        close(dev_null);
 
-                break;
+    }
 
-            }
+    printf(ANSI_CLEAR_CONSOLE);
 
-        }
+    int num_notes = 0, num_turns = 0, range_low = -1, range_high = -1;
 
-        if (!is_duplicate) {
+    const char* scale_list[MAX_SCALE_LENGTH];
 
-            notes[unique_count++] = notes[i];
+    int num_scales = 0;
 
-        }
 
-    }
 
-    return unique_count;
+    const char* tuning_spec = "equal";
 
-}
+    const char* guess_spec = NULL;
 
+    int render_cache_mb = DEFAULT_RENDER_CACHE_MB;
 
+    int latency_test = 0;
 
-// Function to select random notes from the generated scale
+    const char* selftest_name = NULL;
 
-void select_random_notes(Note* notes, int num_notes, int num_selected, Note* selected_notes) {
+    const char* bench_name = NULL;
 
-    static int seeded = 0;
+    const char* reverb_path = NULL;
 
-    if (!seeded) {
+    float reverb_mix = 0.3f;
 
-        srand(time(NULL));
+    const char* table_cache_dir = table_cache_default_dir();
 
-        seeded = 1;
+    const char* log_path = NULL;
 
-    }
+    const char* analyze_path = NULL;
 
+    const char* student = getenv("USER") != NULL ? getenv("USER") : "anonymous";
 
+    const char* student_filter = NULL;
 
-    //printf("\nSelecting unique pitch class notes from the full note pool...\n");
+    const char* shm_name = NULL;
 
 
 
-    // Copy the notes to an array we can shuffle
+#ifdef CHORDGAME_TRACE
+    // Start tracing before anything else so argument parsing is covered too
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-trace") == 0) {
+            trace_start(argv[i + 1]);
+        }
+    }
+#endif
 
-    Note available_notes[num_notes];
+    TRACE_BEGIN(parse);
 
-    for (int i = 0; i < num_notes; i++) {
+    for (int i = 1; i < argc; i++) {
 
-        available_notes[i] = notes[i];
+        if (strcmp(argv[i], "-scale") == 0) {
 
-    }
+            char* token = strtok(argv[++i], ",");
 
+            while (token != NULL && num_scales < MAX_SCALE_LENGTH) {
 
+                scale_list[num_scales] = token;
 
-    // Shuffle the entire available note pool
+                num_scales++;
 
-    for (int i = num_notes - 1; i > 0; i--) {
+                token = strtok(NULL, ",");
 
-        int j = rand() % (i + 1);
+            }
 
-        Note temp = available_notes[i];
+        } else if (strcmp(argv[i], "-notes") == 0) {
 
-        available_notes[i] = available_notes[j];
+            num_notes = atoi(argv[++i]);
 
-        available_notes[j] = temp;
+        } else if (strcmp(argv[i], "-range") == 0) {
 
-    }
+            if (sscanf(argv[++i], "%d-%d", &range_low, &range_high) != 2) {
 
+                printf("Error: Invalid range format. Use <low-high>\n");
 
+                return 1;
 
-    // Now pick notes, ensuring unique pitch classes
+            }
 
-    int pitch_class_used[NUM_NOTES] = {0};
+        } else if (strcmp(argv[i], "-turns") == 0) {
 
-    int selected_count = 0;
+            num_turns = atoi(argv[++i]);
 
+        } else if (strcmp(argv[i], "-tuning") == 0) {
 
+            tuning_spec = argv[++i];
 
-    for (int i = 0; i < num_notes && selected_count < num_selected; i++) {
+        } else if (strcmp(argv[i], "-a4") == 0) {
 
-        int pc = available_notes[i].pitch_class;
+            a4_frequency = atof(argv[++i]);
 
-        if (!pitch_class_used[pc]) {
+            if (a4_frequency <= 0.0) {
 
-            selected_notes[selected_count++] = available_notes[i];
+                printf("Error: Invalid A4 reference frequency\n");
 
-            pitch_class_used[pc] = 1;
+                return 1;
 
+            }
 
+        } else if (strcmp(argv[i], "-play") == 0) {
 
-            /*printf("  -> Selected: %s (Pitch class %d, Octave %d, Freq %.2f)\n",
+            const char* mode = argv[++i];
 
-                   available_notes[i].name, pc, available_notes[i].octave, available_notes[i].frequency); */
+            if (strcmp(mode, "chord") == 0) {
 
-        }
+                presentation_mode = PLAY_CHORD;
 
-    }
+            } else if (strcmp(mode, "arpeggio") == 0) {
 
+                presentation_mode = PLAY_ARPEGGIO;
 
+            } else if (strcmp(mode, "melody") == 0) {
 
-    if (selected_count < num_selected) {
+                presentation_mode = PLAY_MELODY;
 
-        //printf("Warning: Not enough unique pitch classes available to select %d notes.\n", num_selected);
+            } else {
 
-    }
+                printf("Error: Unknown play mode %s. Use chord, arpeggio or melody\n", mode);
 
+                return 1;
 
+            }
 
-    // Sort the selected notes by frequency (optional)
+        } else if (strcmp(argv[i], "-tempo") == 0) {
 
-    qsort(selected_notes, selected_count, sizeof(Note), compare_by_frequency);
+            tempo_bpm = atoi(argv[++i]);
 
+            if (tempo_bpm < 20 || tempo_bpm > 400) {
 
+                printf("Error: Tempo must be between 20 and 400 bpm\n");
 
-    /*printf("\nFinal selected notes (sorted by frequency):\n");
+                return 1;
 
-    for (int i = 0; i < selected_count; i++) {
+            }
 
-        printf("  [%d] %s (Octave %d, Freq %.2f)\n", i + 1,
+        } else if (strcmp(argv[i], "-loop") == 0) {
 
-               selected_notes[i].name, selected_notes[i].octave, selected_notes[i].frequency);
+            sequence_loops = atoi(argv[++i]);
 
-    }*/
+        } else if (strcmp(argv[i], "-timing") == 0) {
 
-}
+            report_timing = 1;
 
-// Function to print the generated notes
+        } else if (strcmp(argv[i], "-reveal") == 0) {
 
-void print_generated_scale(Note* generated_scale, int num_notes) {
+            reveal_mode = 1;
 
-    for (int i = 0; i < num_notes; i++) {
+        } else if (strcmp(argv[i], "-fps") == 0) {
 
-        printf(" Note: %-10s | Octave: %d | Frequency: %.2f Hz\n",
+            reveal_fps = atoi(argv[++i]);
 
-                generated_scale[i].name,
+            if (reveal_fps < 1 || reveal_fps > 120) {
 
-               generated_scale[i].octave, generated_scale[i].frequency);
+                printf("Error: Frame rate must be between 1 and 120\n");
 
-    }
+                return 1;
 
-}
+            }
 
+        } else if (strcmp(argv[i], "-rt") == 0) {
 
+            rt_mode = 1;
 
-typedef struct {
+        } else if (strcmp(argv[i], "-latency-ms") == 0) {
 
-    float buffer[BUFFER_SIZE];
+            if (!set_latency_target(atof(argv[++i]))) {
 
-    int index;
+                return 1;
 
-} AudioData;
+            }
 
+        } else if (strcmp(argv[i], "-output") == 0) {
 
+            const char* output = argv[++i];
 
-static int audio_callback(const void* input, void* output, unsigned long framesPerBuffer,
+            if (strncmp(output, "shm", 3) == 0 && (output[3] == '\0' || output[3] == ':')) {
 
-                          const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) {
+                shm_name = output[3] == ':' ? output + 4 : CHORDSHM_DEFAULT_NAME;
 
-    AudioData* data = (AudioData*)userData;
+            } else if (strcmp(output, "portaudio") != 0) {
 
-    float* out = (float*)output;
+                printf("Error: Unknown output %s. Use portaudio or shm[:name]\n", output);
 
-    for (unsigned int i = 0; i < framesPerBuffer; i++) {
+                return 1;
 
-        *out++ = data->buffer[data->index];
+            }
 
-        data->index = (data->index + 1) % BUFFER_SIZE;
+        } else if (strcmp(argv[i], "-latency-test") == 0) {
 
-    }
+            latency_test = 1;
 
-    return paContinue;
+        } else if (strcmp(argv[i], "-selftest") == 0) {
 
-}
+            selftest_name = argv[++i];
 
+        } else if (strcmp(argv[i], "-bench") == 0) {
 
+            bench_name = argv[++i];
 
-void generate_wavetable(Note* selected_notes, int num_notes, AudioData* audioData) {
+        } else if (strcmp(argv[i], "-trace") == 0) {
 
-    memset(audioData->buffer, 0, sizeof(audioData->buffer));
+            i++;  // handled before parsing
 
-    
+#ifndef CHORDGAME_TRACE
 
-    // Scale the amplitude of each note based on the number of notes
+            printf("Warning: -trace needs a build with -DCHORDGAME_TRACE\n");
 
-    double amplitude_factor = 1.0 / num_notes;
+#endif
 
+        } else if (strcmp(argv[i], "-reverb") == 0) {
 
+            reverb_path = argv[++i];
 
-    for (int i = 0; i < num_notes; i++) {
+        } else if (strcmp(argv[i], "-reverb-mix") == 0) {
 
-        double frequency = selected_notes[i].frequency;
+            reverb_mix = atof(argv[++i]);
 
+            if (reverb_mix < 0.0f || reverb_mix > 1.0f) {
 
+                printf("Error: Reverb mix must be between 0 and 1\n");
 
-        for (int j = 0; j < BUFFER_SIZE; j++) {
+                return 1;
 
-            // Scale each note's contribution by the amplitude factor
+            }
 
-            audioData->buffer[j] += amplitude_factor * sin(2.0 * M_PI * frequency * j / SAMPLE_RATE);
+        } else if (strcmp(argv[i], "-log") == 0) {
 
-        }
+            log_path = argv[++i];
 
-    }
+        } else if (strcmp(argv[i], "-analyze") == 0) {
 
-}
+            analyze_path = argv[++i];
 
+        } else if (strcmp(argv[i], "-student") == 0) {
 
+            student = student_filter = argv[++i];
 
-void play_audio(Note* selected_notes, int num_notes) {
+        } else if (strcmp(argv[i], "-table-cache") == 0) {
 
-    AudioData audioData = { .index = 0 };
+            const char* directory = argv[++i];
 
-    generate_wavetable(selected_notes, num_notes, &audioData);
+            table_cache_dir = strcmp(directory, "off") == 0 ? NULL : directory;
 
+        } else if (strcmp(argv[i], "-loudness") == 0) {
 
+            const char* level = argv[++i];
 
-    Pa_Initialize();
+            loudness_phon = strcmp(level, "off") == 0 ? 0.0 : atof(level);
 
-    PaStream* stream;
+            if (strcmp(level, "off") != 0 && (loudness_phon < 20.0 || loudness_phon > 90.0)) {
 
-    Pa_OpenDefaultStream(&stream, 0, 1, paFloat32, SAMPLE_RATE, 4096, audio_callback, &audioData);
+                printf("Error: Loudness level must be between 20 and 90 phon, or off\n");
 
-    Pa_StartStream(stream);
+                return 1;
 
-    Pa_Sleep(3000);
+            }
 
-    Pa_StopStream(stream);
+        } else if (strcmp(argv[i], "-timbre") == 0) {
 
-    Pa_CloseStream(stream);
+            const char* timbre = argv[++i];
 
-    Pa_Terminate();
+            current_timbre = -1;
 
-}
+            for (int t = 0; t < CE_NUM_TIMBRES; t++) {
 
-void solo_audio(Note* selected_notes, int num_notes) {
+                if (strcmp(timbre, ce_timbre_names[t]) == 0) {
 
-    AudioData audioData = { .index = 0 };
+                    current_timbre = t;
 
+                }
 
+            }
 
-    for (int i = 0; i < num_notes; i++) {
+            if (current_timbre < 0) {
 
-        
+                printf("Error: Unknown timbre %s. Use sine, saw, square, triangle or pluck\n", timbre);
 
-        // Generate the wavetable for a single note
+                return 1;
 
-        Note solo_note[1] = { selected_notes[i] };
+            }
 
-        generate_wavetable(solo_note, 1, &audioData);
+        } else if (strcmp(argv[i], "-damping") == 0) {
 
+            current_pluck.damping = atof(argv[++i]);
 
+            if (current_pluck.damping < 0.0 || current_pluck.damping > 1.0) {
 
-        // Play the single note
+                printf("Error: Damping must be between 0 and 1\n");
 
-        Pa_Initialize();
+                return 1;
 
-        PaStream* stream;
+            }
 
-        Pa_OpenDefaultStream(&stream, 0, 1, paFloat32, SAMPLE_RATE, 4096, audio_callback, &audioData);
+        } else if (strcmp(argv[i], "-brightness") == 0) {
 
-        Pa_StartStream(stream);
+            current_pluck.brightness = atof(argv[++i]);
 
-        Pa_Sleep(1000);  // Play each note for  a second
+            if (current_pluck.brightness < 0.0 || current_pluck.brightness > 1.0) {
 
-        int j = i + 1;
+                printf("Error: Brightness must be between 0 and 1\n");
 
-        printf("note [%d] is [%s] at %.2fHz\n",j , selected_notes[i].name, selected_notes[i].frequency );
+                return 1;
 
-        Pa_StopStream(stream);
+            }
 
-        Pa_CloseStream(stream);
+        } else if (strcmp(argv[i], "-headless") == 0) {
 
-        Pa_Terminate();
+            headless = 1;
 
-    }
+        } else if (strcmp(argv[i], "-guesses") == 0) {
 
-}
+            guess_spec = argv[++i];
 
+        } else if (strcmp(argv[i], "-render") == 0) {
 
+            headless_render = 1;
 
-int is_enharmonic_match(const char *input, const char *target) {
+        } else if (strcmp(argv[i], "-cache-mb") == 0) {
 
-    char input_normalized[3], target_normalized[3];
+            render_cache_mb = atoi(argv[++i]);
 
-    normalize_note_name(input, input_normalized);
+            if (render_cache_mb < 0) {
 
-    normalize_note_name(target, target_normalized);
+                render_cache_mb = 0;
 
+            }
 
+        } else if (strcmp(argv[i], "-seed") == 0) {
 
-    // Direct match
+            random_seed = (unsigned int)strtoul(argv[++i], NULL, 10);
 
-    if (strcmp(input_normalized, target_normalized) == 0) {
+            random_seed_set = 1;
 
-        return 1;
+        }
 
     }
 
 
 
-    // Check for known enharmonic equivalence pairs
+    // Just intonation is built relative to the first scale root
+    int tuning_root = num_scales > 0 ? ce_pitch_class(scale_list[0]) : 0;
 
-    // Enharmonic pairs: F# <-> Gb, C# <-> Db, D# <-> Eb, A# <-> Bb
+    tuning_root = tuning_root < 0 ? 0 : tuning_root;
 
-    if ((strcmp(input_normalized, "f#") == 0 && strcmp(target_normalized, "gb") == 0) ||
+    // Map the tables from an earlier run with the same configuration, or build them
+    double tables_start = monotonic_seconds();
 
-        (strcmp(input_normalized, "gb") == 0 && strcmp(target_normalized, "f#") == 0)) {
+    int tables_cached = table_cache_dir != NULL
+                        && table_cache_load(&table_cache, table_cache_dir, table_cache_key(tuning_spec, tuning_root, reverb_path));
 
-        return 1;
+    if (!tables_cached) {
 
-    }
+        char error[256];
 
-    if ((strcmp(input_normalized, "c#") == 0 && strcmp(target_normalized, "db") == 0) ||
+        if (!ce_tuning_load(&current_tuning, tuning_spec, tuning_root, a4_frequency, error, sizeof(error))) {
 
-        (strcmp(input_normalized, "db") == 0 && strcmp(target_normalized, "c#") == 0)) {
+            printf("Error: %s\n", error);
 
-        return 1;
+            return 1;
 
-    }
+        }
 
-    if ((strcmp(input_normalized, "d#") == 0 && strcmp(target_normalized, "eb") == 0) ||
+        ce_loudness_table(&current_tuning, loudness_phon, loudness_table);
 
-        (strcmp(input_normalized, "eb") == 0 && strcmp(target_normalized, "d#") == 0)) {
+    }
 
-        return 1;
+    double tables_seconds = monotonic_seconds() - tables_start;
 
-    }
 
-    if ((strcmp(input_normalized, "a#") == 0 && strcmp(target_normalized, "bb") == 0) ||
 
-        (strcmp(input_normalized, "bb") == 0 && strcmp(target_normalized, "a#") == 0)) {
+    if (latency_test) {
 
-        return 1;
+        return run_latency_test();
 
     }
 
+    if (selftest_name != NULL) {
 
+        return run_selftest(selftest_name);
 
-    return 0;
-
-}
+    }
 
+    if (bench_name != NULL) {
 
+        return run_bench(bench_name);
 
-int compare_user_guess(Note* selected_notes, Note* user_guesses, int num_notes) {
+    }
 
-    for (int i = 0; i < num_notes; i++) {
+    if (analyze_path != NULL) {
 
-        int user_pc = get_pitch_class_from_note(user_guesses[i].name);
+        return run_analytics(analyze_path, student_filter);
 
-        int correct_pc = selected_notes[i].pitch_class;
+    }
 
+    if (argc < 5) {
 
+        printf("Usage: %s -scale <scale> (C,E) -notes <numNotes> -range <low-high> -turns <turnCount>\n", argv[0]);
 
-        if (user_pc == -1 || user_pc != correct_pc) {
+        printf("       [-tuning <equal|just|pythagorean|meantone|werckmeister3|kirnberger3|vallotti|edo:N|file.scl>] [-a4 <Hz of A3 in every tuning>] [-loudness <phon|off>]\n");
 
-            return 0;  // Incorrect or invalid
+        printf("       [-play <chord|arpeggio|melody>] [-tempo <bpm>] [-loop <passes>] [-timing] [-reveal [-fps <n>]]\n");
 
-        }
+        printf("       [-timbre <sine|saw|square|triangle|pluck> [-damping <0-1>] [-brightness <0-1>]]\n");
 
-    }
+        printf("       [-rt] [-latency-ms <ms>] [-latency-test] [-output <portaudio|shm[:name]>]\n");
 
-    return 1;  // All matched
+        printf("       [-reverb <ir.wav> [-reverb-mix <0-1>]] [-selftest <alias|golden|golden-update|prefetch|cache|tuning>] [-bench <reverb|shm|multirate>] [-trace <out.json>]\n");
 
-}
+        printf("       [-headless [-guesses <script|gen:correct|gen:wrong|gen:random>] [-render]] [-seed <n>] [-cache-mb <n>] [-table-cache <dir|off>]\n");
 
+        printf("       [-log <turns.log> [-student <id>]]\n");
 
+        printf("   or: %s -analyze <turns.log> [-student <id>]\n", argv[0]);
 
-// --- Main Game Logic ---
+        return 1;
 
-int main(int argc, char* argv[]) {
+    }
 
-    int total_correct = 0;
 
-    int dev_null = open("/dev/null", O_WRONLY);
 
-    if (dev_null != -1) {
+    TRACE_END(parse, "parse_arguments");
 
-        dup2(dev_null, STDERR_FILENO);  // Redirect stderr to /dev/null
+    TRACE_BEGIN(pool);
 
-        close(dev_null);
+    CeConfig config = {
+        .scales = scale_list,
+        .num_scales = num_scales,
+        .notes_per_turn = num_notes,
+        .range_low = range_low,
+        .range_high = range_high,
+        .turns = num_turns,
+        .tuning = tuning_spec,
+        .a4_hz = a4_frequency,
+        .loudness_phon = loudness_phon,
+        .tuning_table = &current_tuning,     // built or mapped above
+        .loudness_table = loudness_table,
+        .timbre = current_timbre,
+        .pluck = &current_pluck,
+        .sample_rate = SAMPLE_RATE,
+        .shuffle_order = presentation_mode == PLAY_MELODY,
+        .seed = random_seed_set ? random_seed : (uint32_t)time(NULL)
+    };
 
-    }
+    char engine_error[256];
 
-    printf(ANSI_CLEAR_CONSOLE);
+    ChordEngine* engine = ce_create(&config, engine_error, sizeof(engine_error));
 
-    if (argc < 5) {
+    if (engine == NULL) {
 
-        printf("Usage: %s -scale <scale> (C,E) -notes <numNotes> -range <low-high> -turns <turnCount>\n", argv[0]);
+        printf("Error: %s\n", engine_error);
 
         return 1;
 
     }
 
+    TRACE_END(pool, "build_note_pool");
 
 
-    int num_notes = 0, num_turns = 0, range_low = -1, range_high = -1;
 
-    Note generated_scale[MAX_SCALE_LENGTH];
+    GuessSource guess_source;
 
-    int num_generated_notes = 0;
+    if (!open_guess_source(guess_spec, &guess_source)) {
 
+        return 1;
 
+    }
 
-    const char* scale_list[MAX_SCALE_LENGTH];
+    TurnLog turn_log = {0};
 
-    int num_scales = 0;
+    if (log_path != NULL && !turn_log_open(&turn_log, log_path, student)) {
 
+        return 1;
 
+    }
 
-    int allowed_pitch_classes[NUM_NOTES] = {0}; 
+    double start_time = monotonic_seconds();
 
 
 
-    for (int i = 1; i < argc; i++) {
+    if (!render_cache_init(&render_cache, (size_t)render_cache_mb * 1024 * 1024)) {
 
-        if (strcmp(argv[i], "-scale") == 0) {
+        return 1;
 
-            char* token = strtok(argv[++i], ",");
+    }
 
-            while (token != NULL && num_scales < MAX_SCALE_LENGTH) {
+    tables_start = monotonic_seconds();
 
-                scale_list[num_scales] = token;
+    int reverb_partitions = 0;
 
-                num_scales++;
+    const Complex* reverb_spectra = table_cache_reverb_spectra(&table_cache, &reverb_partitions);
 
-                token = strtok(NULL, ",");
+    if (reverb_path != NULL && reverb_spectra != NULL) {
 
-            }
+        if (!reverb_init_from_spectra(&reverb, reverb_spectra, reverb_partitions, reverb_mix)) {
 
-        } else if (strcmp(argv[i], "-notes") == 0) {
+            return 1;
 
-            num_notes = atoi(argv[++i]);
+        }
 
-        } else if (strcmp(argv[i], "-range") == 0) {
+    } else if (reverb_path != NULL && !reverb_load(&reverb, reverb_path, reverb_mix)) {
 
-            if (sscanf(argv[++i], "%d-%d", &range_low, &range_high) != 2) {
+        return 1;
 
-                printf("Error: Invalid range format. Use <low-high>\n");
+    }
 
-                return 1;
+    if (!tables_cached && table_cache_dir != NULL) {
 
-            }
+        table_cache_store(&table_cache, table_cache_dir, &current_tuning, &reverb);
 
-        } else if (strcmp(argv[i], "-turns") == 0) {
+    }
 
-            num_turns = atoi(argv[++i]);
+    tables_seconds += monotonic_seconds() - tables_start;
 
-        }
+    if (report_timing) {
 
-    }
+        printf("Synthesis tables: %s in %.3f ms\n", tables_cached ? "mapped from cache" : "built", tables_seconds * 1000.0);
 
+    }
 
+    if (shm_name != NULL && !headless && !shm_output_create(shm_name, (int)latency.frames_per_buffer)) {
 
-    get_allowed_pitch_classes(allowed_pitch_classes, scale_list, num_scales);
+        return 1;
 
+    }
 
+    if (rt_mode) {
 
-    for (int i = 0; i < num_scales; i++) {
+        rt_setup();
 
-        generate_major_scale(scale_list[i], generated_scale, &num_generated_notes, range_low, range_high, allowed_pitch_classes);
+        rt_lock_buffer(&audio_tap, sizeof(audio_tap));
 
     }
 
+    TurnPrefetch prefetch;
 
+    prefetch_init(&prefetch);
 
-    qsort(generated_scale, num_generated_notes, sizeof(Note), compare_by_frequency);
-
-    num_generated_notes = remove_duplicates(generated_scale, num_generated_notes);
-
+    int next_count;
 
+    const Note* next_notes = ce_next_turn_notes(engine, &next_count);
 
-    for (int turn = 0; turn < num_turns; turn++) {
+    if (next_count > 0) {
 
-        int total_turns = turn + 1;
+        prefetch_start(&prefetch, next_notes, next_count);
 
-        
+    }
 
-        printf("\nTurn %d:\n", turn + 1);
+    CeEvent event;
 
-        Note selected_notes[num_notes];
+    while (ce_step(engine, &event) && event.type == CE_EVENT_TURN_START) {
 
-        select_random_notes(generated_scale, num_generated_notes, num_notes, selected_notes);
+        TRACE_BEGIN(turn);
 
         
 
-        printf("Playing audio...\n");
+        printf("\nTurn %d:\n", event.turn);
 
-        play_audio(selected_notes, num_notes);
+        int num_selected;
 
+        const Note* turn_notes = ce_turn_notes(engine, &num_selected);
 
+        Note selected_notes[NUM_NOTES];
 
-        Note user_guesses[num_notes];
+        memcpy(selected_notes, turn_notes, sizeof(Note) * num_selected);
 
-        int correct_guesses = 0;
+        RenderCacheEntry* turn_entry = NULL;
 
+        if (!prefetch_finish(&prefetch, &turn_entry)) {
 
+            // Nothing usable was prefetched; render this turn now
 
-  /*      for (int i = 0; i < num_notes; i++) {
+            if (presentation_mode == PLAY_CHORD && (!headless || headless_render)) {
 
-    char guess[4];
+                turn_entry = render_cache_acquire(&render_cache, selected_notes, num_selected, NULL);
 
-    while (1) {
+            }
 
-        printf("Please guess note name [%d] (e.g., C, D#, Ab), or 'r' to repeat, 's' to solo, 'q' to quit: ", i + 1);
+        }
 
-        char input_line[100];
+        next_notes = ce_next_turn_notes(engine, &next_count);
 
-        if (fgets(input_line, sizeof(input_line), stdin)) {
+        if (next_count > 0) {
 
-            sscanf(input_line, "%3s", guess);  // read up to 3 chars
+            prefetch_start(&prefetch, next_notes, next_count);  // render the next turn while this one is answered
 
         }
 
+        
 
+        printf("Playing audio...\n");
 
-        // Check for commands BEFORE validating as note
-
-        if (strcmp(guess, "R") == 0 || strcmp(guess, "r") == 0) {
-
-            printf("Repeating selection.\n");
-
-            play_audio(selected_notes, num_notes);
+        if (turn_entry != NULL) {
 
-            continue;  // ask again for this note guess
+            play_wavetable(turn_entry->audio);
 
-        } 
+        } else {
 
-        else if (strcmp(guess, "S") == 0 || strcmp(guess, "s") == 0) {
+            play_audio(selected_notes, num_selected);
 
-            printf(ANSI_CLEAR_CONSOLE);
+        }
 
-            printf("Soloing selection.\n");
 
-            solo_audio(selected_notes, num_notes);
 
-            continue;  // ask again for this note guess
+        double guess_start = monotonic_seconds();
+
+        // Feed input to the engine whenever it asks for some, and act on what it reports
+        int turn_over = 0;
+        while (!turn_over) {
+            if (!ce_step(engine, &event)) {
+                int i = ce_guess_index(engine);
+                if (current_tuning.steps_per_octave == NUM_NOTES) {
+                    printf("Please guess note name [%d] (e.g., C, D#, Ab), or 'r' to repeat, 's' to solo, 'x' to delete last, 'q' to quit: ", i + 1);
+                } else {
+                    printf("Please guess note step [%d] (0-%d), or 'r' to repeat, 's' to solo, 'x' to delete last, 'q' to quit: ", i + 1,
+                           current_tuning.steps_per_octave - 1);
+                }
+                char input_line[100];
+                TRACE_BEGIN(think);
+                int have_input = next_guess(&guess_source, selected_notes, i, input_line, sizeof(input_line));
+                TRACE_END(think, "think_time");
+                ce_input(engine, have_input ? input_line : "q");  // end of input quits
+                continue;
+            }
 
-        } 
+            switch (event.type) {
+            case CE_EVENT_REPEAT:
+                printf("Repeating selection.\n");
+                play_audio(selected_notes, num_selected);
+                break;
+            case CE_EVENT_SOLO:
+                printf(ANSI_CLEAR_CONSOLE);
+                printf("Soloing selection.\n");
+                solo_audio(selected_notes, num_selected);
+                break;
+            case CE_EVENT_DELETE:
+                printf("Deleted last guess. Please re-enter.\n");
+                break;
+            case CE_EVENT_INVALID:
+                play_audio(selected_notes, num_selected);
+                printf("Invalid note. Please enter a valid musical note.\n");
+                break;
+            case CE_EVENT_QUIT:
+                printf("Quitting.\n");
+                turn_over = 1;
+                break;
+            case CE_EVENT_TURN_END:
+                turn_over = 1;
+                break;
+            default:
+                break;
+            }
+        }
 
-        else if (strcmp(guess, "Q") == 0 || strcmp(guess, "q") == 0) {
+        if (event.type == CE_EVENT_QUIT) {
 
-            printf("Quitting.\n");
+            render_cache_release(&render_cache, turn_entry);
 
-            return 0;
+            break;
 
         }
 
+        int num_guesses;
 
+        const int* guesses = ce_guesses(engine, &num_guesses);
 
-        // Now validate if the guess is a valid note
+        turn_log_write(&turn_log, selected_notes, guesses, num_selected, monotonic_seconds() - guess_start, event.correct);
 
-        if (!is_valid_note_input(guess)) {
+        if (event.correct) {
 
-            play_audio(selected_notes, num_notes);
+            print_generated_scale(selected_notes, num_selected);
 
-            printf("Invalid note. Please enter a valid musical note.\n");
-
-            continue;
+            game_sleep(500);
 
-        }
+            printf(ANSI_COLOUR_GREEN"Correct! You guessed all the notes correctly.\n"ANSI_COLOUR_RESET);
 
+        } else {
 
+            printf(ANSI_CLEAR_CONSOLE);
 
-        // If valid note, accept and break to next note guess
+            solo_audio(selected_notes, num_selected);
 
-        strcpy(user_guesses[i].name, guess);
+            printf(ANSI_COLOUR_RED"Incorrect guesses. Better Luck Next Time.\n"ANSI_COLOUR_RESET);
 
-        break;
+        }
 
-    }
+        if (reveal_mode) {
 
-}
+            reveal_turn(selected_notes, num_selected, turn_entry);
 
-*/
+        }
 
+        game_sleep(300);
 
-        int i = 0;
-while (i < num_notes) {
-    char guess[4];
-    printf("Please guess note name [%d] (e.g., C, D#, Ab), or 'r' to repeat, 's' to solo, 'x' to delete last, 'q' to quit: ", i + 1);
-    char input_line[100];
-    if (fgets(input_line, sizeof(input_line), stdin)) {
-        sscanf(input_line, "%3s", guess);  // read up to 3 chars
-    }
+        render_cache_release(&render_cache, turn_entry);
 
-    if (strcmp(guess, "R") == 0 || strcmp(guess, "r") == 0) {
-        printf("Repeating selection.\n");
-        play_audio(selected_notes, num_notes);
-        continue;
-    } else if (strcmp(guess, "S") == 0 || strcmp(guess, "s") == 0) {
-        printf(ANSI_CLEAR_CONSOLE);
-        printf("Soloing selection.\n");
-        solo_audio(selected_notes, num_notes);
-        continue;
-    } else if (strcmp(guess, "Q") == 0 || strcmp(guess, "q") == 0) {
-        printf("Quitting.\n");
-        return 0;
-    } else if ((strcmp(guess, "X") == 0 || strcmp(guess, "x") == 0) && i > 0) {
-        printf("Deleted last guess. Please re-enter.\n");
-        i--;  // go back one guess
-        continue;
-    }
+        TRACE_END(turn, "turn");
 
-    // Validate input
-    if (!is_valid_note_input(guess)) {
-        play_audio(selected_notes, num_notes);
-        printf("Invalid note. Please enter a valid musical note.\n");
-        continue;
-    }
 
-    // Store valid guess
-    strcpy(user_guesses[i].name, guess);
-    i++;  // move to next guess
-}
 
-        if (compare_user_guess(selected_notes, user_guesses, num_notes)) {
+        printf(ANSI_CLEAR_CONSOLE);
 
-            total_correct++;
+        float percentage = ((float) ce_stats(engine)->correct / event.turn) * 100;
 
-            print_generated_scale(selected_notes, num_notes);
+        
 
-            Pa_Sleep(500);
+            printf("You got %.2f%% of the guesses correct across all %d turns.\n", percentage, event.turn);
 
-            printf(ANSI_COLOUR_GREEN"Correct! You guessed all the notes correctly.\n"ANSI_COLOUR_RESET);
 
-        } else {
 
-            printf(ANSI_CLEAR_CONSOLE);
+    }
 
-            solo_audio(selected_notes, num_notes);
 
-            
 
-            printf(ANSI_COLOUR_RED"Incorrect guesses. Better Luck Next Time.\n"ANSI_COLOUR_RESET);
+    prefetch_cancel(&prefetch);
 
-        }
+    if (headless) {
 
-        Pa_Sleep(300);
+        print_headless_summary(ce_stats(engine), monotonic_seconds() - start_time);
 
+        print_render_cache_stats(&render_cache);
 
+    }
 
-        printf(ANSI_CLEAR_CONSOLE);
+    render_cache_destroy(&render_cache);
 
-        float percentage = ((float) total_correct / total_turns) * 100;
+    turn_log_close(&turn_log);
 
-        
+    ce_destroy(engine);
 
-            printf("You got %.2f%% of the guesses correct across all %d turns.\n", percentage, total_turns);
+    shm_output_destroy();
 
+    if (guess_source.script != NULL) {
 
+        fclose(guess_source.script);
 
     }
 
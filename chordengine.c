@@ -0,0 +1,1351 @@
+// chordengine.c - reentrant ChordGame core; see chordengine.h for the API.
+
+#include "chordengine.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define CE_DEFAULT_SAMPLE_RATE 48000
+#define CE_INPUT_QUEUE 16
+#define CE_INPUT_LENGTH 4       // a guess is read as up to 3 characters
+#define CE_OSCILLATOR_BLOCK 4096  // samples between cancellation checks
+#define CE_VOICE_LEVEL 0.5      // peak of a lone voice before its equal-loudness gain
+#define CE_MAX_LOUDNESS_BOOST_DB 12.0  // octave 0 would otherwise need about +30 dB
+
+const char* const ce_note_names[CE_NUM_NOTES] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+const char* const ce_enharmonic_names[CE_NUM_NOTES] = {"C", "db", "D", "eb", "E", "F", "gb", "G", "ab", "A", "bb", "B"};
+const char* const ce_timbre_names[CE_NUM_TIMBRES] = {"sine", "saw", "square", "triangle", "pluck"};
+
+static const int major_scale_intervals[7] = {2, 2, 1, 2, 2, 2, 1};
+
+static void set_error(char* error, int error_size, const char* message, const char* detail) {
+    if (error != NULL && error_size > 0) {
+        snprintf(error, error_size, message, detail);
+    }
+}
+
+// --- Notes ---
+
+int ce_pitch_class(const char* name) {
+    char lower[4];
+    int length = 0;
+    while (name[length] != '\0' && length < 3) {
+        lower[length] = (char)tolower((unsigned char)name[length]);
+        length++;
+    }
+    if (name[length] != '\0') {
+        return -1;
+    }
+    lower[length] = '\0';
+
+    for (int pc = 0; pc < CE_NUM_NOTES; pc++) {
+        const char* spellings[2] = {ce_note_names[pc], ce_enharmonic_names[pc]};
+        for (int s = 0; s < 2; s++) {
+            const char* spelling = spellings[s];
+            int i = 0;
+            while (spelling[i] != '\0' && tolower((unsigned char)spelling[i]) == lower[i]) {
+                i++;
+            }
+            if (spelling[i] == '\0' && lower[i] == '\0') {
+                return pc;
+            }
+        }
+    }
+    return -1;
+}
+
+int ce_enharmonic_match(const char* a, const char* b) {
+    int pc = ce_pitch_class(a);
+    return pc != -1 && pc == ce_pitch_class(b);
+}
+
+int ce_note_number(int pitch_class, int octave) {
+    return (octave + 1) * 12 + pitch_class;  // Shift octave correctly
+}
+
+// --- Tuning ---
+
+// Just intonation ratios (5-limit) for each interval above the root
+static const double just_ratios[CE_NUM_NOTES] = {1.0, 16.0/15, 9.0/8, 6.0/5, 5.0/4, 4.0/3, 45.0/32, 3.0/2, 8.0/5, 5.0/3, 9.0/5, 15.0/8};
+
+typedef struct {
+    const char* name;
+    double cents[CE_NUM_NOTES];  // offsets from C, re-anchored on A when the tuning is loaded
+} Temperament;
+
+static const Temperament temperaments[] = {
+    {"pythagorean",   {0, 90.22, 203.91, 294.13, 407.82, 498.04, 611.73, 701.96, 792.18, 905.87, 996.09, 1109.78}},
+    {"meantone",      {0, 76.05, 193.16, 310.26, 386.31, 503.42, 579.47, 696.58, 772.63, 889.74, 1006.84, 1082.89}},
+    {"werckmeister3", {0, 90.22, 192.18, 294.13, 390.22, 498.04, 588.27, 696.09, 792.18, 888.27, 996.09, 1092.18}},
+    {"kirnberger3",   {0, 90.22, 193.16, 294.13, 386.31, 498.04, 590.22, 696.58, 792.18, 889.74, 996.09, 1088.27}},
+    {"vallotti",      {0, 94.13, 196.09, 298.04, 392.18, 501.96, 592.18, 698.04, 796.09, 894.13, 1000.00, 1090.22}},
+};
+static const int num_temperaments = sizeof(temperaments) / sizeof(temperaments[0]);
+
+// Frequency of a step of a tuning, computed directly (used to fill the table)
+static double tuning_frequency(const CeTuning* tuning, int step, int octave) {
+    double cents = (octave + 1) * tuning->period_cents + tuning->step_cents[step];
+    return tuning->c0_frequency * pow(2.0, cents / 1200.0);
+}
+
+static void build_frequency_table(CeTuning* tuning) {
+    for (int octave = 0; octave < CE_NUM_OCTAVES; octave++) {
+        for (int step = 0; step < tuning->steps_per_octave; step++) {
+            tuning->frequency_table[octave][step] = tuning_frequency(tuning, step, octave);
+        }
+    }
+}
+
+// Keep A at the reference pitch and distribute the tuning around it: the step nearest A
+// (900 cents above C, which is A itself in 12-step tunings) is moved so that in octave 3 it
+// sounds at exactly the A reference, and every other step moves with it
+static void anchor_on_a(CeTuning* tuning) {
+    int a_step = 0;
+    for (int s = 1; s < tuning->steps_per_octave; s++) {
+        if (fabs(tuning->step_cents[s] - 900.0) < fabs(tuning->step_cents[a_step] - 900.0)) {
+            a_step = s;
+        }
+    }
+    double a_cents = CE_CONCERT_A_NOTE_NUMBER * 100.0;  // above c0_frequency
+    int a_octave = CE_CONCERT_A_NOTE_NUMBER / CE_NUM_NOTES;
+    double shift = a_cents - a_octave * tuning->period_cents - tuning->step_cents[a_step];
+    for (int s = 0; s < tuning->steps_per_octave; s++) {
+        tuning->step_cents[s] += shift;
+    }
+}
+
+// Parse one pitch line of a Scala file: cents if it contains a '.', otherwise a ratio "a/b" or "a"
+static int parse_scala_pitch(const char* line, double* cents) {
+    while (isspace((unsigned char)*line)) {
+        line++;
+    }
+    const char* end = line;
+    while (*end != '\0' && !isspace((unsigned char)*end)) {
+        end++;
+    }
+    if (memchr(line, '.', end - line) != NULL) {
+        char* parsed_end;
+        *cents = strtod(line, &parsed_end);
+        return parsed_end != line;
+    }
+    long numerator = 0, denominator = 1;
+    if (sscanf(line, "%ld/%ld", &numerator, &denominator) < 1 || numerator <= 0 || denominator <= 0) {
+        return 0;
+    }
+    *cents = 1200.0 * log2((double)numerator / denominator);
+    return 1;
+}
+
+// Load a Scala (.scl) scale file. Degree 0 (1/1) is anchored on C and the last entry is the period.
+static int load_scala_file(const char* path, CeTuning* tuning, char* error, int error_size) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        set_error(error, error_size, "Could not open Scala file %s", path);
+        return 0;
+    }
+
+    char line[256];
+    int field = 0;  // 0 = description, 1 = note count, then pitches
+    int num_pitches = 0, pitches_read = 0;
+    tuning->step_cents[0] = 0.0;
+
+    while (fgets(line, sizeof(line), file) && (field < 2 || pitches_read < num_pitches)) {
+        if (line[0] == '!') {
+            continue;  // comment
+        }
+        if (field == 0) {
+            field++;
+            continue;
+        }
+        if (field == 1) {
+            if (sscanf(line, "%d", &num_pitches) != 1 || num_pitches < 1 || num_pitches > CE_MAX_TUNING_STEPS) {
+                set_error(error, error_size, "Invalid note count in Scala file %s", path);
+                fclose(file);
+                return 0;
+            }
+            field++;
+            continue;
+        }
+        double cents;
+        if (!parse_scala_pitch(line, &cents)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            set_error(error, error_size, "Invalid pitch '%s' in Scala file", line);
+            fclose(file);
+            return 0;
+        }
+        pitches_read++;
+        if (pitches_read < num_pitches) {
+            tuning->step_cents[pitches_read] = cents;
+        } else {
+            tuning->period_cents = cents;
+        }
+    }
+    fclose(file);
+
+    if (field < 2 || pitches_read < num_pitches || tuning->period_cents <= 0.0) {
+        set_error(error, error_size, "Scala file %s is incomplete", path);
+        return 0;
+    }
+    tuning->steps_per_octave = num_pitches;
+    snprintf(tuning->name, sizeof(tuning->name), "%s", path);
+    return 1;
+}
+
+int ce_tuning_load(CeTuning* tuning, const char* spec, int root_pitch_class, double a4_hz,
+                   char* error, int error_size) {
+    memset(tuning, 0, sizeof(*tuning));
+    tuning->period_cents = 1200.0;
+    tuning->steps_per_octave = CE_NUM_NOTES;
+    tuning->c0_frequency = (a4_hz > 0.0 ? a4_hz : CE_DEFAULT_A4) / pow(2.0, CE_CONCERT_A_NOTE_NUMBER / 12.0);
+    snprintf(tuning->name, sizeof(tuning->name), "%s", spec);
+    root_pitch_class = root_pitch_class < 0 || root_pitch_class >= CE_NUM_NOTES ? 0 : root_pitch_class;
+
+    int edo_steps;
+    size_t len = strlen(spec);
+
+    if (strcmp(spec, "equal") == 0) {
+        for (int pc = 0; pc < CE_NUM_NOTES; pc++) {
+            tuning->step_cents[pc] = pc * 100.0;
+        }
+    } else if (strcmp(spec, "just") == 0) {
+        for (int pc = 0; pc < CE_NUM_NOTES; pc++) {
+            int interval = (pc - root_pitch_class + CE_NUM_NOTES) % CE_NUM_NOTES;
+            tuning->step_cents[pc] = root_pitch_class * 100.0 + 1200.0 * log2(just_ratios[interval])
+                                     - (pc < root_pitch_class ? 1200.0 : 0.0);
+        }
+    } else if (sscanf(spec, "edo:%d", &edo_steps) == 1) {
+        if (edo_steps < 1 || edo_steps > CE_MAX_TUNING_STEPS) {
+            set_error(error, error_size, "EDO size must be between 1 and %s", "128");
+            return 0;
+        }
+        tuning->steps_per_octave = edo_steps;
+        for (int s = 0; s < edo_steps; s++) {
+            tuning->step_cents[s] = 1200.0 * s / edo_steps;
+        }
+    } else if (len > 4 && strcmp(spec + len - 4, ".scl") == 0) {
+        if (!load_scala_file(spec, tuning, error, error_size)) {
+            return 0;
+        }
+    } else {
+        int found = 0;
+        for (int t = 0; t < num_temperaments; t++) {
+            if (strcmp(spec, temperaments[t].name) == 0) {
+                for (int pc = 0; pc < CE_NUM_NOTES; pc++) {
+                    tuning->step_cents[pc] = temperaments[t].cents[pc];
+                }
+                found = 1;
+                break;
+            }
+        }
+        if (!found) {
+            set_error(error, error_size, "Unknown tuning %s", spec);
+            return 0;
+        }
+    }
+
+    anchor_on_a(tuning);
+    build_frequency_table(tuning);
+    return 1;
+}
+
+double ce_tuning_frequency(const CeTuning* tuning, int step, int octave) {
+    if (octave < CE_MIN_OCTAVE || octave > CE_MAX_OCTAVE) {
+        return tuning_frequency(tuning, step, octave);
+    }
+    return tuning->frequency_table[octave][step];
+}
+
+void ce_step_name(const CeTuning* tuning, int step, char* name, int size) {
+    if (tuning->steps_per_octave == CE_NUM_NOTES) {
+        snprintf(name, size, "%s", ce_note_names[step]);
+    } else {
+        snprintf(name, size, "%u", (unsigned char)step);  // steps are below CE_MAX_TUNING_STEPS
+    }
+}
+
+int ce_parse_step(const CeTuning* tuning, const char* name) {
+    if (tuning->steps_per_octave == CE_NUM_NOTES) {
+        return ce_pitch_class(name);
+    }
+    int step = 0;
+    for (int i = 0; name[i] != '\0'; i++) {
+        if (!isdigit((unsigned char)name[i]) || i == 3) {
+            return -1;
+        }
+        step = step * 10 + (name[i] - '0');
+    }
+    return name[0] != '\0' && step < tuning->steps_per_octave ? step : -1;
+}
+
+// Nearest 12-tone pitch class of a step, for hosts that draw a keyboard
+static int nearest_pitch_class(const CeTuning* tuning, int step) {
+    if (tuning->steps_per_octave == CE_NUM_NOTES) {
+        return step;
+    }
+    long semitones = lround(tuning->step_cents[step] / 100.0);
+    return (int)(((semitones % CE_NUM_NOTES) + CE_NUM_NOTES) % CE_NUM_NOTES);
+}
+
+// --- Equal loudness ---
+// A low note at the same amplitude sounds much quieter than a mid-range one. Each note is
+// scaled by how many dB louder than 1 kHz it must be to sound equally loud on the ISO
+// 226:2003 contour for the chosen phon level.
+
+#define ISO226_POINTS 29
+
+static const double iso226_frequency[ISO226_POINTS] = {
+    20, 25, 31.5, 40, 50, 63, 80, 100, 125, 160, 200, 250, 315, 400, 500,
+    630, 800, 1000, 1250, 1600, 2000, 2500, 3150, 4000, 5000, 6300, 8000, 10000, 12500};
+static const double iso226_af[ISO226_POINTS] = {
+    0.532, 0.506, 0.480, 0.455, 0.432, 0.409, 0.387, 0.367, 0.349, 0.330, 0.315, 0.301, 0.288, 0.276, 0.267,
+    0.259, 0.253, 0.250, 0.246, 0.244, 0.243, 0.243, 0.243, 0.242, 0.242, 0.245, 0.254, 0.271, 0.301};
+static const double iso226_lu[ISO226_POINTS] = {
+    -31.6, -27.2, -23.0, -19.1, -15.9, -13.0, -10.3, -8.1, -6.2, -4.5, -3.1, -2.0, -1.1, -0.4, 0.0,
+    0.3, 0.5, 0.0, -2.7, -4.1, -1.0, 1.7, 2.5, 1.2, -2.1, -7.1, -11.2, -10.7, -3.1};
+static const double iso226_tf[ISO226_POINTS] = {
+    78.5, 68.7, 59.5, 51.1, 44.0, 37.5, 31.5, 26.5, 22.1, 17.9, 14.4, 11.4, 8.6, 6.2, 4.4,
+    3.0, 2.2, 2.4, 3.5, 1.7, -1.3, -4.2, -6.0, -5.4, -1.5, 6.0, 12.6, 13.9, 12.3};
+
+// Sound pressure level (dB SPL) at table point i that is as loud as the given phon level
+static double iso226_spl(int i, double phon) {
+    double af = iso226_af[i];
+    double a = 4.47e-3 * (pow(10.0, 0.025 * phon) - 1.15)
+               + pow(0.4 * pow(10.0, (iso226_tf[i] + iso226_lu[i]) / 10.0 - 9.0), af);
+    return 10.0 / af * log10(a) - iso226_lu[i] + 94.0;
+}
+
+// Interpolate the contour on a log-frequency axis, holding its ends outside 20 Hz - 12.5 kHz
+static double equal_loudness_spl(double frequency, double phon) {
+    if (frequency <= iso226_frequency[0]) {
+        return iso226_spl(0, phon);
+    }
+    for (int i = 1; i < ISO226_POINTS; i++) {
+        if (frequency <= iso226_frequency[i]) {
+            double x = log(frequency / iso226_frequency[i - 1]) / log(iso226_frequency[i] / iso226_frequency[i - 1]);
+            return (1.0 - x) * iso226_spl(i - 1, phon) + x * iso226_spl(i, phon);
+        }
+    }
+    return iso226_spl(ISO226_POINTS - 1, phon);
+}
+
+double ce_loudness_gain(double frequency, double phon) {
+    if (phon <= 0.0) {
+        return 1.0;
+    }
+    double boost_db = equal_loudness_spl(frequency, phon) - equal_loudness_spl(1000.0, phon);
+    if (boost_db > CE_MAX_LOUDNESS_BOOST_DB) {
+        boost_db = CE_MAX_LOUDNESS_BOOST_DB;
+    }
+    return pow(10.0, boost_db / 20.0);
+}
+
+void ce_loudness_table(const CeTuning* tuning, double phon, double table[CE_NUM_OCTAVES][CE_MAX_TUNING_STEPS]) {
+    for (int octave = 0; octave < CE_NUM_OCTAVES; octave++) {
+        for (int step = 0; step < tuning->steps_per_octave; step++) {
+            table[octave][step] = ce_loudness_gain(tuning->frequency_table[octave][step], phon);
+        }
+    }
+}
+
+// --- Note pool and turns ---
+
+static int compare_by_frequency(const void* a, const void* b) {
+    const CeNote* note_a = (const CeNote*)a;
+    const CeNote* note_b = (const CeNote*)b;
+    return (note_a->frequency > note_b->frequency) - (note_a->frequency < note_b->frequency);
+}
+
+// Append a note unless the pool already holds it. Returns 0 if the pool is full.
+static int add_pool_note(const CeTuning* tuning, int step, int octave, CeNote* pool, int* size, int max_pool) {
+    for (int i = 0; i < *size; i++) {
+        if (pool[i].step == step && pool[i].octave == octave) {
+            return 1;
+        }
+    }
+    if (*size == max_pool) {
+        return 0;
+    }
+    int twelve_step = tuning->steps_per_octave == CE_NUM_NOTES;
+    CeNote* note = &pool[(*size)++];
+    *note = (CeNote){
+        .step = step,
+        .pitch_class = nearest_pitch_class(tuning, step),
+        .octave = octave,
+        .frequency = ce_tuning_frequency(tuning, step, octave),
+        .enharmonic_equiv = twelve_step ? ce_enharmonic_names[step] : NULL
+    };
+    ce_step_name(tuning, step, note->name, sizeof(note->name));
+    return 1;
+}
+
+int ce_build_pool(const CeTuning* tuning, const char* const* roots, int num_roots, int range_low, int range_high,
+                  CeNote* pool, int max_pool, char* error, int error_size) {
+    int size = 0;
+    int twelve_step = tuning->steps_per_octave == CE_NUM_NOTES;
+    for (int r = 0; r < num_roots; r++) {
+        int root_pitch_class = -1;
+        for (int pc = 0; pc < CE_NUM_NOTES; pc++) {
+            if (strcmp(roots[r], ce_note_names[pc]) == 0 || strcmp(roots[r], ce_enharmonic_names[pc]) == 0) {
+                root_pitch_class = pc;
+                break;
+            }
+        }
+        if (root_pitch_class == -1) {
+            set_error(error, error_size, "Invalid root note %s", roots[r]);
+            return -1;
+        }
+
+        // Every degree of the scale is placed in the octave being filled. At most 12 notes
+        // per octave survive, so the pool never fills.
+        for (int octave = range_low; octave <= range_high && twelve_step; octave++) {
+            int pc = root_pitch_class;
+            for (int i = 0; i < 7; i++) {
+                add_pool_note(tuning, pc, octave, pool, &size, max_pool);
+                pc = (pc + major_scale_intervals[i]) % CE_NUM_NOTES;
+            }
+        }
+    }
+
+    for (int octave = range_low; octave <= range_high && !twelve_step; octave++) {
+        for (int step = 0; step < tuning->steps_per_octave; step++) {
+            if (!add_pool_note(tuning, step, octave, pool, &size, max_pool)) {
+                if (error != NULL && error_size > 0) {
+                    snprintf(error, error_size, "Octaves %d-%d of %s hold more than %d notes; narrow the range",
+                             range_low, range_high, tuning->name, max_pool);
+                }
+                return -1;
+            }
+        }
+    }
+
+    qsort(pool, size, sizeof(CeNote), compare_by_frequency);
+    return size;
+}
+
+// xorshift32; a zero state is replaced so every seed works
+uint32_t ce_random(uint32_t* state) {
+    uint32_t x = *state != 0 ? *state : 0x9e3779b9u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+int ce_select_notes(const CeNote* pool, int pool_size, int count, CeNote* selected, uint32_t* rng) {
+    if (pool_size > CE_MAX_POOL) {
+        pool_size = CE_MAX_POOL;
+    }
+    CeNote available[CE_MAX_POOL];
+    memcpy(available, pool, sizeof(CeNote) * pool_size);
+
+    // Shuffle the whole pool, then take notes in that order skipping repeated steps
+    for (int i = pool_size - 1; i > 0; i--) {
+        int j = (int)(ce_random(rng) % (uint32_t)(i + 1));
+        CeNote temp = available[i];
+        available[i] = available[j];
+        available[j] = temp;
+    }
+    int step_used[CE_MAX_TUNING_STEPS] = {0};
+    int selected_count = 0;
+    for (int i = 0; i < pool_size && selected_count < count; i++) {
+        int step = available[i].step;
+        if (!step_used[step]) {
+            selected[selected_count++] = available[i];
+            step_used[step] = 1;
+        }
+    }
+
+    qsort(selected, selected_count, sizeof(CeNote), compare_by_frequency);
+    return selected_count;
+}
+
+void ce_shuffle_notes(CeNote* notes, int count, uint32_t* rng) {
+    for (int i = count - 1; i > 0; i--) {
+        int j = (int)(ce_random(rng) % (uint32_t)(i + 1));
+        CeNote temp = notes[i];
+        notes[i] = notes[j];
+        notes[j] = temp;
+    }
+}
+
+int ce_judge(const CeNote* answers, const int* guessed_steps, int count) {
+    for (int i = 0; i < count; i++) {
+        if (guessed_steps[i] != answers[i].step) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// --- Synthesis ---
+// Sawtooth and square use PolyBLEP, triangle uses PolyBLAMP: the naive waveform plus a
+// two-sample polynomial correction at each discontinuity. Voices are kept as arrays of
+// phases so the per-sample loop runs across voices; on x86 it takes four voices per SSE
+// register, with the corrections and phase wraps done by masks instead of branches.
+
+#define VOICE_LANES ((CE_NUM_NOTES + 3) & ~3)   // voice arrays padded to whole SSE registers
+
+static inline float positive_part(float x) {
+    return x > 0.0f ? x : 0.0f;   // maxss; fmaxf would be a libm call
+}
+
+// Step correction for a discontinuity at phase 0; t is the phase in [0, 1) and inverse is
+// 1 / the increment. after is nonzero only just past the wrap and before only approaching
+// it, so the correction needs no branches and the voice loops compile to straight-line code.
+static inline float poly_blep(float t, float inverse) {
+    float after = positive_part(1.0f - t * inverse);
+    float before = positive_part((t - 1.0f) * inverse + 1.0f);
+    return before * before - after * after;
+}
+
+// Integrated PolyBLEP residual for a unit change of slope per sample, for corners
+static inline float poly_blamp(float t, float inverse) {
+    float after = positive_part(1.0f - t * inverse);
+    float before = positive_part((t - 1.0f) * inverse + 1.0f);
+    return (after * after * after + before * before * before) * (1.0f / 6.0f);
+}
+
+static inline float wrap_phase(float t) {
+    return t >= 1.0f ? t - 1.0f : t;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline __m128 wrap_phase4(__m128 t) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpge_ps(t, one), one));
+}
+
+static inline void blep_distances4(__m128 t, __m128 inverse, __m128* after, __m128* before) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    *after = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(t, inverse)), _mm_setzero_ps());
+    *before = _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(t, one), inverse), one), _mm_setzero_ps());
+}
+
+static inline __m128 poly_blep4(__m128 t, __m128 inverse) {
+    __m128 after, before;
+    blep_distances4(t, inverse, &after, &before);
+    return _mm_sub_ps(_mm_mul_ps(before, before), _mm_mul_ps(after, after));
+}
+
+static inline __m128 poly_blamp4(__m128 t, __m128 inverse) {
+    __m128 after, before;
+    blep_distances4(t, inverse, &after, &before);
+    __m128 cubes = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(after, after), after), _mm_mul_ps(_mm_mul_ps(before, before), before));
+    return _mm_mul_ps(cubes, _mm_set1_ps(1.0f / 6.0f));
+}
+
+// Add length samples of PolyBLEP voices into buffer, four voices at a time. Lanes past the
+// last voice have zero amplitude, increment and inverse, so they add nothing.
+static void render_blep_block_sse(int timbre, float* phase, const float* increment, const float* inverse,
+                                  const float* amplitudes, int num_voices, float* buffer, int length) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 eight = _mm_set1_ps(8.0f);
+    const __m128 sign_bit = _mm_set1_ps(-0.0f);
+    for (int j = 0; j < length; j++) {
+        __m128 sum = _mm_setzero_ps();
+        for (int v = 0; v < num_voices; v += 4) {
+            __m128 t = _mm_loadu_ps(phase + v);
+            __m128 dt = _mm_loadu_ps(increment + v);
+            __m128 inv = _mm_loadu_ps(inverse + v);
+            __m128 value;
+            if (timbre == CE_TIMBRE_SAW) {
+                value = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(two, t), one), poly_blep4(t, inv));
+            } else if (timbre == CE_TIMBRE_SQUARE) {
+                __m128 t2 = wrap_phase4(_mm_add_ps(t, half));
+                value = _mm_add_ps(_mm_mul_ps(two, _mm_sub_ps(t2, t)), _mm_sub_ps(poly_blep4(t, inv), poly_blep4(t2, inv)));
+            } else {
+                __m128 t2 = wrap_phase4(_mm_add_ps(t, half));
+                __m128 corner = _mm_andnot_ps(sign_bit, _mm_sub_ps(_mm_mul_ps(two, t), one));
+                __m128 naive = _mm_sub_ps(_mm_mul_ps(two, corner), one);
+                value = _mm_sub_ps(naive, _mm_mul_ps(_mm_mul_ps(eight, dt), _mm_sub_ps(poly_blamp4(t, inv), poly_blamp4(t2, inv))));
+            }
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(amplitudes + v), value));
+            _mm_storeu_ps(phase + v, wrap_phase4(_mm_add_ps(t, dt)));
+        }
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        buffer[j] += _mm_cvtss_f32(sum);
+    }
+}
+#endif
+
+// The flag only asks the render to stop early, so no ordering is needed
+static inline int is_cancelled(const atomic_int* cancel) {
+    return cancel != NULL && atomic_load_explicit(cancel, memory_order_relaxed);
+}
+
+static long floor_div(long a, long b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static int render_sine_voices(const double* frequencies, const float* amplitudes, int num_voices, double sample_rate,
+                              long start_frame, float* buffer, int length, const atomic_int* cancel) {
+    for (int v = 0; v < num_voices; v++) {
+        if (is_cancelled(cancel)) {
+            return 0;
+        }
+        double frequency = frequencies[v];
+        double amplitude = amplitudes[v];
+        for (int j = 0; j < length; j++) {
+            buffer[j] += amplitude * sin(2.0 * M_PI * frequency * (start_frame + j) / sample_rate);
+        }
+    }
+    return 1;
+}
+
+// --- Plucked strings ---
+// Extended Karplus-Strong: a noise burst circulates in a delay line through a one-zero
+// lowpass, a loss gain and a first-order allpass that supplies the fractional part of the
+// period. The filters' phase delays are computed at the fundamental, so the loop is
+// exactly one period long at any pitch, and the loss is set so the fundamental decays by
+// 60 dB in the damping's T60. A string costs five multiply-adds per sample.
+
+#define PLUCK_MIN_ALLPASS_DELAY 0.1  // keeps the allpass coefficient well inside (-1, 1)
+#define PLUCK_LONGEST_T60 8.0        // seconds, damping 0
+#define PLUCK_SHORTEST_T60 0.2       // seconds, damping 1
+#define PLUCK_DARKEST_PICK 0.9       // one-pole smoothing of the burst at brightness 0
+
+static const CePluck default_pluck = { CE_DEFAULT_PLUCK_DAMPING, CE_DEFAULT_PLUCK_BRIGHTNESS };
+
+typedef struct {
+    float* line;
+    int length;          // integer part of the period
+    int position;
+    float amplitude;
+    float b0, b1;        // one-zero lowpass with the loss folded in
+    float allpass;       // first-order allpass coefficient
+    float x1;            // lowpass input history
+    float allpass_x1, allpass_y1;
+} PluckString;
+
+static double clamp_unit(double value) {
+    return value < 0.0 ? 0.0 : (value > 1.0 ? 1.0 : value);
+}
+
+// Delay line capacity a string at this frequency needs
+static int pluck_capacity(double frequency, int sample_rate) {
+    return (int)ceil(sample_rate / frequency) + 1;
+}
+
+static void pluck_init(PluckString* string, float* line, double frequency, float amplitude,
+                       const CePluck* pluck, int sample_rate) {
+    double brightness = clamp_unit(pluck->brightness);
+    double t60 = PLUCK_LONGEST_T60 * pow(PLUCK_SHORTEST_T60 / PLUCK_LONGEST_T60, clamp_unit(pluck->damping));
+    double period = sample_rate / frequency;
+    double w = 2.0 * M_PI / period;
+    double decay = pow(10.0, -3.0 / (frequency * t60));  // gain per period
+
+    // Brightness sets the lowpass weight, capped so the lowpass alone never loses more
+    // than the decay allows; high strings would otherwise die within a few periods
+    double weight = 0.5 * (1.0 - brightness);
+    double bound = (1.0 - decay * decay) / (2.0 * (1.0 - cos(w)));
+    if (bound < 0.25) {
+        double weight_limit = 0.5 * (1.0 - sqrt(1.0 - 4.0 * bound));
+        weight = weight < weight_limit ? weight : weight_limit;
+    }
+    double response_re = (1.0 - weight) + weight * cos(w);
+    double response_im = -weight * sin(w);
+    double lowpass_delay = atan2(-response_im, response_re) / w;
+    double loss = decay / hypot(response_re, response_im);
+
+    int length = (int)floor(period - lowpass_delay - PLUCK_MIN_ALLPASS_DELAY);
+    length = length < 1 ? 1 : length;
+    double allpass_delay = period - lowpass_delay - length;
+
+    *string = (PluckString){
+        .line = line,
+        .length = length,
+        .amplitude = amplitude,
+        .b0 = (float)((1.0 - weight) * loss),
+        .b1 = (float)(weight * loss),
+        .allpass = (float)(sin(w * (1.0 - allpass_delay) / 2.0) / sin(w * (1.0 + allpass_delay) / 2.0))
+    };
+
+    // Excitation: one period of noise, smoothed for darker plucks, without DC and
+    // normalised to a unit peak. Seeded from the pitch, so a chord always sounds the same.
+    uint32_t rng = 0x2545f491u ^ (uint32_t)llround(frequency * 1000.0);
+    double smoothing = PLUCK_DARKEST_PICK * (1.0 - brightness);
+    double smoothed = 0.0, mean = 0.0, peak = 0.0;
+    for (int i = 0; i < length; i++) {
+        double noise = (double)ce_random(&rng) / 2147483648.0 - 1.0;
+        smoothed = (1.0 - smoothing) * noise + smoothing * smoothed;
+        line[i] = (float)smoothed;
+        mean += smoothed;
+    }
+    mean /= length;
+    for (int i = 0; i < length; i++) {
+        line[i] -= (float)mean;
+        peak = fabs(line[i]) > peak ? fabs(line[i]) : peak;
+    }
+    for (int i = 0; i < length && peak > 0.0; i++) {
+        line[i] = (float)(line[i] / peak);
+    }
+}
+
+// Run a string for length samples, adding its output to buffer (or discarding it if NULL)
+static void pluck_run(PluckString* string, float* buffer, int length) {
+    float* line = string->line;
+    int position = string->position;
+    float x1 = string->x1, allpass_x1 = string->allpass_x1, allpass_y1 = string->allpass_y1;
+    const float b0 = string->b0, b1 = string->b1, c = string->allpass, amplitude = string->amplitude;
+
+    for (int j = 0; j < length; j++) {
+        float x = line[position];
+        float lowpass = b0 * x + b1 * x1;
+        float y = c * (lowpass - allpass_y1) + allpass_x1;
+        x1 = x;
+        allpass_x1 = lowpass;
+        allpass_y1 = y;
+        line[position] = y;
+        if (++position == string->length) {
+            position = 0;
+        }
+        if (buffer != NULL) {
+            buffer[j] += amplitude * x;
+        }
+    }
+    string->position = position;
+    string->x1 = x1;
+    string->allpass_x1 = allpass_x1;
+    string->allpass_y1 = allpass_y1;
+}
+
+struct CePluckStrings {
+    int max_voices;
+    int capacity;                       // delay line length each string has room for
+    double lowest_frequency;
+    int sample_rate;
+    int num_voices;
+    PluckString strings[CE_NUM_NOTES];
+    float* lines;
+};
+
+CePluckStrings* ce_pluck_strings_create(int max_voices, double lowest_frequency, int sample_rate) {
+    if (max_voices < 1 || lowest_frequency <= 0.0 || sample_rate <= 0) {
+        return NULL;
+    }
+    CePluckStrings* strings = calloc(1, sizeof(CePluckStrings));
+    if (strings == NULL) {
+        return NULL;
+    }
+    strings->max_voices = max_voices > CE_NUM_NOTES ? CE_NUM_NOTES : max_voices;
+    strings->capacity = pluck_capacity(lowest_frequency, sample_rate);
+    strings->lowest_frequency = lowest_frequency;
+    strings->sample_rate = sample_rate;
+    strings->lines = malloc(sizeof(float) * strings->max_voices * strings->capacity);
+    if (strings->lines == NULL) {
+        free(strings);
+        return NULL;
+    }
+    return strings;
+}
+
+int ce_pluck_strings_pluck(CePluckStrings* strings, const double* frequencies, const float* amplitudes,
+                           int num_voices, const CePluck* pluck) {
+    if (num_voices > strings->max_voices) {
+        return 0;
+    }
+    for (int v = 0; v < num_voices; v++) {
+        if (frequencies[v] < strings->lowest_frequency) {
+            return 0;
+        }
+    }
+    if (pluck == NULL) {
+        pluck = &default_pluck;
+    }
+    for (int v = 0; v < num_voices; v++) {
+        pluck_init(&strings->strings[v], strings->lines + v * strings->capacity, frequencies[v], amplitudes[v], pluck,
+                   strings->sample_rate);
+    }
+    strings->num_voices = num_voices;
+    return 1;
+}
+
+int ce_pluck_strings_render(CePluckStrings* strings, float* buffer, int length, const atomic_int* cancel) {
+    int completed = !is_cancelled(cancel);
+    for (int start = 0; start < length && completed; start += CE_OSCILLATOR_BLOCK) {
+        int count = length - start < CE_OSCILLATOR_BLOCK ? length - start : CE_OSCILLATOR_BLOCK;
+        for (int v = 0; v < strings->num_voices; v++) {
+            pluck_run(&strings->strings[v], buffer + start, count);
+        }
+        completed = !is_cancelled(cancel);
+    }
+    return completed;
+}
+
+void ce_pluck_strings_destroy(CePluckStrings* strings) {
+    if (strings != NULL) {
+        free(strings->lines);
+    }
+    free(strings);
+}
+
+int ce_render_plucked(const double* frequencies, const float* amplitudes, int num_voices, const CePluck* pluck,
+                      int sample_rate, float* buffer, int length, const atomic_int* cancel) {
+    if (num_voices > CE_NUM_NOTES) {
+        num_voices = CE_NUM_NOTES;
+    }
+    if (num_voices < 1) {
+        return !is_cancelled(cancel);
+    }
+    double lowest = frequencies[0];
+    for (int v = 1; v < num_voices; v++) {
+        lowest = frequencies[v] < lowest ? frequencies[v] : lowest;
+    }
+    CePluckStrings* strings = ce_pluck_strings_create(num_voices, lowest, sample_rate);
+    if (strings == NULL) {
+        return 0;
+    }
+    ce_pluck_strings_pluck(strings, frequencies, amplitudes, num_voices, pluck);
+    int completed = ce_pluck_strings_render(strings, buffer, length, cancel);
+    ce_pluck_strings_destroy(strings);
+    return completed;
+}
+
+// Sine or PolyBLEP voices at one rate, which need not be a whole number, from any frame
+// including negative ones
+static int render_oscillators(const double* frequencies, const float* amplitudes, int num_voices, int timbre,
+                              double sample_rate, long start_frame, float* buffer, int length,
+                              const atomic_int* cancel) {
+    if (num_voices == 0) {
+        return !is_cancelled(cancel);
+    }
+    if (timbre == CE_TIMBRE_SINE) {
+        return render_sine_voices(frequencies, amplitudes, num_voices, sample_rate, start_frame, buffer, length, cancel);
+    }
+
+    // Blocks sit on absolute multiples of CE_OSCILLATOR_BLOCK frames and each one restarts
+    // from the exact phase, so float drift stays bounded and a sound rendered in pieces is
+    // bit-identical to one rendered whole.
+    float phase[VOICE_LANES] = {0};
+    float increment[VOICE_LANES] = {0};
+    float inverse[VOICE_LANES] = {0};
+    float amplitude[VOICE_LANES] = {0};
+    for (int v = 0; v < num_voices; v++) {
+        increment[v] = (float)(frequencies[v] / sample_rate);
+        inverse[v] = (float)(sample_rate / frequencies[v]);
+        amplitude[v] = amplitudes[v];
+    }
+
+    long block_frame = floor_div(start_frame, CE_OSCILLATOR_BLOCK) * CE_OSCILLATOR_BLOCK;
+    for (int block = (int)(block_frame - start_frame); block < length; block += CE_OSCILLATOR_BLOCK) {
+        if (is_cancelled(cancel)) {
+            return 0;
+        }
+        for (int v = 0; v < num_voices; v++) {
+            double cycles = frequencies[v] / sample_rate * (start_frame + block);
+            phase[v] = (float)(cycles - floor(cycles));
+        }
+        // A piece that starts inside a block advances to its first frame the same way
+        for (int j = block; j < 0; j++) {
+            for (int v = 0; v < num_voices; v++) {
+                phase[v] = wrap_phase(phase[v] + increment[v]);
+            }
+        }
+        int start = block < 0 ? 0 : block;
+        int end = block + CE_OSCILLATOR_BLOCK < length ? block + CE_OSCILLATOR_BLOCK : length;
+#if defined(__x86_64__) || defined(__i386__)
+        render_blep_block_sse(timbre, phase, increment, inverse, amplitude, num_voices, buffer + start, end - start);
+#else
+        // One loop nest per timbre keeps the inner loop over voices free of calls
+        switch (timbre) {
+        case CE_TIMBRE_SAW:
+            for (int j = start; j < end; j++) {
+                float sum = 0.0f;
+                for (int v = 0; v < num_voices; v++) {
+                    float t = phase[v];
+                    sum += amplitude[v] * (2.0f * t - 1.0f - poly_blep(t, inverse[v]));
+                    phase[v] = wrap_phase(t + increment[v]);
+                }
+                buffer[j] += sum;
+            }
+            break;
+        case CE_TIMBRE_SQUARE:
+            for (int j = start; j < end; j++) {
+                float sum = 0.0f;
+                for (int v = 0; v < num_voices; v++) {
+                    float t = phase[v];
+                    float dt = increment[v];
+                    // A saw half a cycle ahead minus this one: the +-1 levels come out as 2 * (t2 - t)
+                    float t2 = wrap_phase(t + 0.5f);
+                    sum += amplitude[v] * (2.0f * (t2 - t) + poly_blep(t, inverse[v]) - poly_blep(t2, inverse[v]));
+                    phase[v] = wrap_phase(t + dt);
+                }
+                buffer[j] += sum;
+            }
+            break;
+        default:
+            for (int j = start; j < end; j++) {
+                float sum = 0.0f;
+                for (int v = 0; v < num_voices; v++) {
+                    float t = phase[v];
+                    float dt = increment[v];
+                    // Corners at t = 0 (peak) and t = 0.5 (trough); the slope changes by 8 per cycle
+                    float t2 = wrap_phase(t + 0.5f);
+                    sum += amplitude[v] * (2.0f * fabsf(2.0f * t - 1.0f) - 1.0f
+                                            - 8.0f * dt * (poly_blamp(t, inverse[v]) - poly_blamp(t2, inverse[v])));
+                    phase[v] = wrap_phase(t + dt);
+                }
+                buffer[j] += sum;
+            }
+            break;
+        }
+#endif
+    }
+    return 1;
+}
+
+// --- Multi-rate rendering ---
+// A voice whose content all sits far below the Nyquist frequency wastes most of its
+// samples at the full rate. Each voice is rendered at the lowest rate sample_rate / 2^level
+// that still holds it in its lower half; the voices of a level are summed there, and the
+// sum is doubled in rate by a half-band interpolator and added to the level above, down to
+// the output. So a chord pays for one interpolator per level, not one per voice. The
+// interpolators are symmetric and read ahead, so each level is rendered with a margin
+// around the frames the level above needs; oscillator blocks sit on absolute frames of
+// their own rate, and a sound rendered in pieces is still bit-identical to one rendered
+// whole.
+
+#define MULTIRATE_MAX_LEVEL 5        // lowest rate is sample_rate / 32
+#define MULTIRATE_PASSBAND 0.25      // a voice stays below this fraction of its level's rate
+#define HALFBAND_TAPS 7              // odd-phase taps on each side of an output sample
+#define MULTIRATE_SCRATCH (CE_OSCILLATOR_BLOCK + MULTIRATE_MAX_LEVEL * (2 * HALFBAND_TAPS + 2))
+
+// Odd phase of a 27-tap Kaiser-windowed (beta 11.5) half-band interpolator: flat within
+// 1e-5 up to a quarter of the input rate, and over 110 dB down from three quarters of it,
+// where that band's images land. The even phase is the input itself.
+static const float halfband[HALFBAND_TAPS] = {
+    6.2062054e-01f, -1.6841361e-01f, 6.6192080e-02f, -2.4255498e-02f, 7.1871025e-03f, -1.4894494e-03f, 1.5806319e-04f
+};
+
+// Only sines have all their content at one frequency. The PolyBLEP waveforms' harmonics
+// reach the Nyquist frequency at any pitch (a triangle's are still -60 dB at the 31st,
+// and a saw's fall only 6 dB per octave), and a pluck starts as broadband noise, so those
+// keep the full rate.
+static int voice_rate_level(double frequency, int timbre, int sample_rate) {
+    int level = 0;
+    while (timbre == CE_TIMBRE_SINE && level < MULTIRATE_MAX_LEVEL
+           && frequency <= MULTIRATE_PASSBAND * sample_rate / (2 << level)) {
+        level++;
+    }
+    return level;
+}
+
+int ce_voice_rate_divisor(double frequency, int timbre, int sample_rate) {
+    return 1 << voice_rate_level(frequency, timbre, sample_rate);
+}
+
+// Interpolate input (which starts at frame input_start of the lower rate) and add it into
+// output[0, length), which starts at frame output_start of the doubled rate
+static void halfband_upsample_add(const float* input, long input_start, float* output, long output_start, int length) {
+    long first = floor_div(output_start, 2);
+    long last = floor_div(output_start + length - 1, 2);
+    for (long n = first; n <= last; n++) {
+        const float* x = input + (n - input_start);
+        float odd = 0.0f;
+        for (int k = 0; k < HALFBAND_TAPS; k++) {
+            odd += halfband[k] * (x[-k] + x[k + 1]);
+        }
+        long even = 2 * n - output_start;
+        if (even >= 0) {
+            output[even] += x[0];
+        }
+        if (even + 1 < length) {
+            output[even + 1] += odd;
+        }
+    }
+}
+
+static int render_multirate(const double* frequencies, const float* amplitudes, int num_voices, int timbre,
+                            int sample_rate, long start_frame, float* buffer, int length, const atomic_int* cancel) {
+    double level_frequencies[MULTIRATE_MAX_LEVEL + 1][CE_NUM_NOTES];
+    float level_amplitudes[MULTIRATE_MAX_LEVEL + 1][CE_NUM_NOTES];
+    int level_voices[MULTIRATE_MAX_LEVEL + 1] = {0};
+    int top = 0;
+    for (int v = 0; v < num_voices; v++) {
+        int level = voice_rate_level(frequencies[v], timbre, sample_rate);
+        level_frequencies[level][level_voices[level]] = frequencies[v];
+        level_amplitudes[level][level_voices[level]++] = amplitudes[v];
+        top = level > top ? level : top;
+    }
+    if (top == 0) {
+        return render_oscillators(frequencies, amplitudes, num_voices, timbre, sample_rate, start_frame, buffer, length,
+                                  cancel);
+    }
+
+    float scratch[MULTIRATE_SCRATCH];
+    long end_frame = start_frame + length;
+    for (long block = floor_div(start_frame, CE_OSCILLATOR_BLOCK) * CE_OSCILLATOR_BLOCK; block < end_frame;
+         block += CE_OSCILLATOR_BLOCK) {
+        if (is_cancelled(cancel)) {
+            return 0;
+        }
+        // Frames [first, end) of each level's rate, outermost first
+        long first[MULTIRATE_MAX_LEVEL + 1], end[MULTIRATE_MAX_LEVEL + 1];
+        float* out[MULTIRATE_MAX_LEVEL + 1];
+        first[0] = block > start_frame ? block : start_frame;
+        end[0] = block + CE_OSCILLATOR_BLOCK < end_frame ? block + CE_OSCILLATOR_BLOCK : end_frame;
+        out[0] = buffer + (first[0] - start_frame);
+        float* unused = scratch;
+        for (int level = 1; level <= top; level++) {
+            first[level] = floor_div(first[level - 1], 2) - (HALFBAND_TAPS - 1);
+            end[level] = floor_div(end[level - 1] - 1, 2) + HALFBAND_TAPS + 1;
+            out[level] = unused;
+            unused += end[level] - first[level];
+            memset(out[level], 0, sizeof(float) * (end[level] - first[level]));
+        }
+        for (int level = top; level >= 0; level--) {
+            render_oscillators(level_frequencies[level], level_amplitudes[level], level_voices[level], timbre,
+                               (double)sample_rate / (1 << level), first[level], out[level],
+                               (int)(end[level] - first[level]), NULL);
+            if (level > 0) {
+                halfband_upsample_add(out[level], first[level], out[level - 1], first[level - 1],
+                                      (int)(end[level - 1] - first[level - 1]));
+            }
+        }
+    }
+    return 1;
+}
+
+int ce_render_voices(const double* frequencies, const float* amplitudes, int num_voices, int timbre, int sample_rate,
+                     long start_frame, float* buffer, int length, const atomic_int* cancel) {
+    if (num_voices > CE_NUM_NOTES) {
+        num_voices = CE_NUM_NOTES;
+    }
+    if (timbre == CE_TIMBRE_PLUCK) {
+        // Strings are stateful; later pieces come from a CePluckStrings the caller keeps
+        return start_frame == 0 && ce_render_plucked(frequencies, amplitudes, num_voices, NULL, sample_rate, buffer,
+                                                     length, cancel);
+    }
+    return render_multirate(frequencies, amplitudes, num_voices, timbre, sample_rate, start_frame, buffer, length, cancel);
+}
+
+int ce_render_voices_full_rate(const double* frequencies, const float* amplitudes, int num_voices, int timbre,
+                               int sample_rate, long start_frame, float* buffer, int length,
+                               const atomic_int* cancel) {
+    if (num_voices > CE_NUM_NOTES) {
+        num_voices = CE_NUM_NOTES;
+    }
+    if (timbre == CE_TIMBRE_PLUCK) {
+        // Strings are stateful; later pieces come from a CePluckStrings the caller keeps
+        return start_frame == 0 && ce_render_plucked(frequencies, amplitudes, num_voices, NULL, sample_rate, buffer,
+                                                     length, cancel);
+    }
+    return render_oscillators(frequencies, amplitudes, num_voices, timbre, sample_rate, start_frame, buffer, length,
+                              cancel);
+}
+
+double ce_voice_amplitude(double loudness_gain, int num_voices) {
+    return CE_VOICE_LEVEL * loudness_gain / sqrt(num_voices > 0 ? num_voices : 1);
+}
+
+// --- Games ---
+
+typedef enum {
+    STATE_NEXT_TURN,   // next step starts a turn or ends the game
+    STATE_GUESSING,    // waiting for guesses
+    STATE_COMPLETE,    // all guesses in; next step judges
+    STATE_OVER
+} GameState;
+
+struct ChordEngine {
+    CeTuning tuning;
+    double loudness[CE_NUM_OCTAVES][CE_MAX_TUNING_STEPS];
+    CeNote pool[CE_MAX_POOL];
+    int pool_size;
+    int notes_per_turn;
+    int turns;
+    int timbre;
+    CePluck pluck;
+    int sample_rate;
+    int shuffle_order;
+    uint32_t rng;
+
+    GameState state;
+    int turn;                          // turns started so far
+    CeNote turn_notes[CE_NUM_NOTES];
+    int turn_count;
+    CeNote next_notes[CE_NUM_NOTES];
+    int next_count;
+    int guesses[CE_NUM_NOTES];
+    int guess_count;
+    long render_frame;
+    CePluckStrings* strings;           // CE_TIMBRE_PLUCK state, carried across ce_render calls
+    CeStats stats;
+
+    char queue[CE_INPUT_QUEUE][CE_INPUT_LENGTH];
+    int queue_head;
+    int queue_count;
+};
+
+static void pick_next_turn(ChordEngine* engine) {
+    engine->next_count = ce_select_notes(engine->pool, engine->pool_size, engine->notes_per_turn, engine->next_notes, &engine->rng);
+    if (engine->shuffle_order) {
+        ce_shuffle_notes(engine->next_notes, engine->next_count, &engine->rng);
+    }
+}
+
+ChordEngine* ce_create(const CeConfig* config, char* error, int error_size) {
+    ChordEngine* engine = calloc(1, sizeof(ChordEngine));
+    if (engine == NULL) {
+        set_error(error, error_size, "Out of memory%s", "");
+        return NULL;
+    }
+    if (config->tuning_table != NULL) {
+        engine->tuning = *config->tuning_table;
+    } else {
+        const char* tuning = config->tuning != NULL ? config->tuning : "equal";
+        int root = config->num_scales > 0 ? ce_pitch_class(config->scales[0]) : 0;
+        if (!ce_tuning_load(&engine->tuning, tuning, root, config->a4_hz, error, error_size)) {
+            free(engine);
+            return NULL;
+        }
+    }
+    if (config->loudness_table != NULL) {
+        memcpy(engine->loudness, config->loudness_table, sizeof(engine->loudness));
+    } else {
+        ce_loudness_table(&engine->tuning, config->loudness_phon, engine->loudness);
+    }
+
+    if (config->range_low < CE_MIN_OCTAVE || config->range_high > CE_MAX_OCTAVE || config->range_low > config->range_high) {
+        set_error(error, error_size, "Octave range must be within 0-8%s", "");
+        free(engine);
+        return NULL;
+    }
+    engine->pool_size = ce_build_pool(&engine->tuning, config->scales, config->num_scales, config->range_low,
+                                      config->range_high, engine->pool, CE_MAX_POOL, error, error_size);
+    if (engine->pool_size < 0) {
+        free(engine);
+        return NULL;
+    }
+
+    int distinct = 0;
+    int seen[CE_MAX_TUNING_STEPS] = {0};
+    for (int i = 0; i < engine->pool_size; i++) {
+        distinct += !seen[engine->pool[i].step];
+        seen[engine->pool[i].step] = 1;
+    }
+    // A chord has at most CE_NUM_NOTES voices, however many steps the tuning has
+    int most = distinct < CE_NUM_NOTES ? distinct : CE_NUM_NOTES;
+    if (config->notes_per_turn < 1 || config->notes_per_turn > most) {
+        if (error != NULL && error_size > 0) {
+            const char* limit = distinct > CE_NUM_NOTES ? "the most voices in a chord"
+                                : engine->tuning.steps_per_octave == CE_NUM_NOTES ? "the distinct pitch classes in the scales"
+                                : "the distinct steps in the range";
+            snprintf(error, error_size, "Notes per turn must be between 1 and %d, %s", most, limit);
+        }
+        free(engine);
+        return NULL;
+    }
+
+    engine->notes_per_turn = config->notes_per_turn;
+    engine->turns = config->turns;
+    engine->timbre = config->timbre;
+    engine->pluck = config->pluck != NULL ? *config->pluck : default_pluck;
+    engine->sample_rate = config->sample_rate > 0 ? config->sample_rate : CE_DEFAULT_SAMPLE_RATE;
+    if (engine->timbre == CE_TIMBRE_PLUCK) {
+        // The pool is sorted, so its first note needs the longest delay line
+        engine->strings = ce_pluck_strings_create(CE_NUM_NOTES, engine->pool[0].frequency, engine->sample_rate);
+        if (engine->strings == NULL) {
+            set_error(error, error_size, "Out of memory%s", "");
+            free(engine);
+            return NULL;
+        }
+    }
+    engine->shuffle_order = config->shuffle_order;
+    engine->rng = config->seed;
+    engine->state = STATE_NEXT_TURN;
+    if (engine->turns > 0) {
+        pick_next_turn(engine);
+    }
+    return engine;
+}
+
+void ce_destroy(ChordEngine* engine) {
+    if (engine != NULL) {
+        ce_pluck_strings_destroy(engine->strings);
+    }
+    free(engine);
+}
+
+int ce_input(ChordEngine* engine, const char* line) {
+    if (engine->queue_count == CE_INPUT_QUEUE) {
+        return 0;
+    }
+    // Keep the first word, up to 3 characters, as the guess reader always has
+    while (isspace((unsigned char)*line)) {
+        line++;
+    }
+    char* slot = engine->queue[(engine->queue_head + engine->queue_count) % CE_INPUT_QUEUE];
+    int length = 0;
+    while (line[length] != '\0' && !isspace((unsigned char)line[length]) && length < CE_INPUT_LENGTH - 1) {
+        slot[length] = line[length];
+        length++;
+    }
+    slot[length] = '\0';
+    engine->queue_count++;
+    return 1;
+}
+
+static int is_command(const char* input, char command) {
+    return input[0] != '\0' && input[1] == '\0' && tolower((unsigned char)input[0]) == command;
+}
+
+int ce_step(ChordEngine* engine, CeEvent* event) {
+    event->type = CE_EVENT_NONE;
+    event->turn = engine->turn;
+    event->index = engine->guess_count;
+    event->correct = 0;
+
+    switch (engine->state) {
+    case STATE_NEXT_TURN:
+        if (engine->turn >= engine->turns) {
+            engine->state = STATE_OVER;
+            event->type = CE_EVENT_GAME_OVER;
+            return 1;
+        }
+        memcpy(engine->turn_notes, engine->next_notes, sizeof(engine->turn_notes));
+        engine->turn_count = engine->next_count;
+        engine->turn++;
+        engine->next_count = 0;
+        if (engine->turn < engine->turns) {
+            pick_next_turn(engine);
+        }
+        engine->guess_count = 0;
+        engine->render_frame = 0;
+        engine->queue_count = 0;  // input typed during the previous turn does not carry over
+        engine->state = STATE_GUESSING;
+        event->type = CE_EVENT_TURN_START;
+        event->turn = engine->turn;
+        event->index = 0;
+        return 1;
+
+    case STATE_GUESSING: {
+        if (engine->queue_count == 0) {
+            return 0;
+        }
+        const char* input = engine->queue[engine->queue_head];
+        engine->queue_head = (engine->queue_head + 1) % CE_INPUT_QUEUE;
+        engine->queue_count--;
+
+        if (is_command(input, 'r')) {
+            engine->stats.repeats++;
+            engine->render_frame = 0;
+            event->type = CE_EVENT_REPEAT;
+        } else if (is_command(input, 's')) {
+            engine->stats.solos++;
+            event->type = CE_EVENT_SOLO;
+        } else if (is_command(input, 'q')) {
+            engine->stats.quits++;
+            engine->state = STATE_OVER;
+            event->type = CE_EVENT_QUIT;
+        } else if (is_command(input, 'x') && engine->guess_count > 0) {
+            engine->stats.deletes++;
+            engine->guess_count--;
+            event->type = CE_EVENT_DELETE;
+        } else {
+            int step = ce_parse_step(&engine->tuning, input);
+            if (step < 0) {
+                engine->stats.invalid++;
+                event->type = CE_EVENT_INVALID;
+            } else {
+                event->type = CE_EVENT_GUESS;
+                event->index = engine->guess_count;
+                engine->guesses[engine->guess_count++] = step;
+                if (engine->guess_count == engine->turn_count) {
+                    engine->state = STATE_COMPLETE;
+                }
+            }
+        }
+        return 1;
+    }
+
+    case STATE_COMPLETE:
+        engine->stats.turns++;
+        event->correct = ce_judge(engine->turn_notes, engine->guesses, engine->turn_count);
+        if (event->correct) {
+            engine->stats.correct++;
+        } else {
+            engine->stats.incorrect++;
+        }
+        engine->state = STATE_NEXT_TURN;
+        event->type = CE_EVENT_TURN_END;
+        return 1;
+
+    case STATE_OVER:
+    default:
+        return 0;
+    }
+}
+
+const CeNote* ce_turn_notes(const ChordEngine* engine, int* count) {
+    *count = engine->turn_count;
+    return engine->turn_notes;
+}
+
+const CeNote* ce_next_turn_notes(const ChordEngine* engine, int* count) {
+    *count = engine->next_count;
+    return engine->next_notes;
+}
+
+int ce_guess_index(const ChordEngine* engine) {
+    return engine->guess_count;
+}
+
+const int* ce_guesses(const ChordEngine* engine, int* count) {
+    *count = engine->guess_count;
+    return engine->guesses;
+}
+
+const CeStats* ce_stats(const ChordEngine* engine) {
+    return &engine->stats;
+}
+
+const CeNote* ce_pool(const ChordEngine* engine, int* size) {
+    *size = engine->pool_size;
+    return engine->pool;
+}
+
+int ce_render(ChordEngine* engine, float* out, int frames) {
+    long total = (long)CE_CHORD_SECONDS * engine->sample_rate;
+    long remaining = total - engine->render_frame;
+    if (engine->turn_count == 0 || remaining <= 0) {
+        return 0;
+    }
+    if (frames > remaining) {
+        frames = (int)remaining;
+    }
+    double frequencies[CE_NUM_NOTES];
+    float amplitudes[CE_NUM_NOTES];
+    for (int v = 0; v < engine->turn_count; v++) {
+        const CeNote* note = &engine->turn_notes[v];
+        frequencies[v] = note->frequency;
+        amplitudes[v] = (float)ce_voice_amplitude(engine->loudness[note->octave][note->step], engine->turn_count);
+    }
+    memset(out, 0, sizeof(float) * frames);
+    if (engine->timbre == CE_TIMBRE_PLUCK) {
+        if (engine->render_frame == 0) {
+            ce_pluck_strings_pluck(engine->strings, frequencies, amplitudes, engine->turn_count, &engine->pluck);
+        }
+        ce_pluck_strings_render(engine->strings, out, frames, NULL);
+    } else {
+        ce_render_voices(frequencies, amplitudes, engine->turn_count, engine->timbre, engine->sample_rate,
+                         engine->render_frame, out, frames, NULL);
+    }
+    engine->render_frame += frames;
+    return frames;
+}
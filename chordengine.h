@@ -0,0 +1,270 @@
+// chordengine.h - the ChordGame core as an embeddable, reentrant C library.
+//
+// Everything a game needs besides I/O lives here: note parsing, tuning tables,
+// equal-loudness gains, the note pool, turn selection, judging and synthesis. There is
+// no global or static mutable state; a game is a ChordEngine object and every other
+// function works only on its arguments, so any number of games can run in one process
+// on any threads (one thread per ChordEngine at a time).
+//
+// A game is driven without blocking: queue the player's input with ce_input() and call
+// ce_step() until it returns 0. Each call does a bounded amount of work and reports one
+// event, so a single thread can service thousands of games. Audio is pulled with
+// ce_render() at whatever pace the host's output needs.
+//
+// Build: cc -O2 -c chordengine.c, then link chordengine.o with -lm. The ChordGame CLI is
+// a client of this library: cc -O2 Chordgame.c chordengine.c -lportaudio -lm -lpthread
+
+#ifndef CHORDENGINE_H
+#define CHORDENGINE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define CE_NUM_NOTES 12
+#define CE_NUM_OCTAVES 9
+#define CE_MIN_OCTAVE 0
+#define CE_MAX_OCTAVE 8
+#define CE_MAX_TUNING_STEPS 128   // steps per period of an edo:N or Scala tuning
+#define CE_MAX_POOL 256
+#define CE_CONCERT_A_NOTE_NUMBER 57   // (octave + 1) * 12 + pitch class of A3, the 440 Hz reference
+#define CE_DEFAULT_A4 440.0
+#define CE_DEFAULT_LOUDNESS_PHON 60.0
+#define CE_CHORD_SECONDS 3
+
+#define CE_TIMBRE_SINE 0
+#define CE_TIMBRE_SAW 1
+#define CE_TIMBRE_SQUARE 2
+#define CE_TIMBRE_TRIANGLE 3
+#define CE_TIMBRE_PLUCK 4
+#define CE_NUM_TIMBRES 5
+
+#define CE_DEFAULT_PLUCK_DAMPING 0.5
+#define CE_DEFAULT_PLUCK_BRIGHTNESS 0.5
+
+// Constant tables: note names with sharps, their flat spellings, and timbre names
+extern const char* const ce_note_names[CE_NUM_NOTES];
+extern const char* const ce_enharmonic_names[CE_NUM_NOTES];
+extern const char* const ce_timbre_names[CE_NUM_TIMBRES];
+
+typedef struct {
+    char name[4];        // "C#", or the step number ("0" to "N-1") in tunings that are not 12-step
+    int step;            // step of the tuning within its octave; the pitch class in 12-step tunings
+    int pitch_class;     // nearest 12-tone pitch class, for display
+    int octave;
+    double frequency;
+    const char* enharmonic_equiv;
+} CeNote;
+
+// --- Notes ---
+
+// Pitch class (0-11) of a name such as "C#", "db" or "E" (case-insensitive), or -1
+int ce_pitch_class(const char* name);
+
+// 1 if both names spell the same pitch class, e.g. "F#" and "Gb"
+int ce_enharmonic_match(const char* a, const char* b);
+
+// MIDI-style note number used for cache keys and the A reference
+int ce_note_number(int pitch_class, int octave);
+
+// --- Tuning ---
+
+typedef struct {
+    char name[64];
+    int steps_per_octave;                        // 12 for the named temperaments, N for N-EDO and .scl files
+    double step_cents[CE_MAX_TUNING_STEPS];      // cents of each step above C
+    double period_cents;                         // size of the repeating interval, normally 1200
+    double c0_frequency;                         // from the A reference
+    double frequency_table[CE_NUM_OCTAVES][CE_MAX_TUNING_STEPS];
+} CeTuning;
+
+// Load "equal", "just", "pythagorean", "meantone", "werckmeister3", "kirnberger3",
+// "vallotti", "edo:N" or a Scala .scl file. Just intonation is built on root_pitch_class.
+// In a 12-step tuning the steps are the pitch classes C to B. Any other tuning keeps all
+// of its steps, which are named by number from "0" (C) upwards. Every tuning is anchored
+// on A: A3 (the step nearest it in other tunings) sounds at a4_hz, and the rest of the
+// tuning follows from its intervals, so C may be off its equal-tempered pitch.
+// Returns 0 and writes a message to error on failure.
+int ce_tuning_load(CeTuning* tuning, const char* spec, int root_pitch_class, double a4_hz,
+                   char* error, int error_size);
+
+// Table lookup inside CE_MIN_OCTAVE..CE_MAX_OCTAVE, computed outside it
+double ce_tuning_frequency(const CeTuning* tuning, int step, int octave);
+
+// Name of a step: the sharp spelling in 12-step tunings, otherwise its number
+void ce_step_name(const CeTuning* tuning, int step, char* name, int size);
+
+// Step named by a guess ("C#", "db" or, in tunings that are not 12-step, "7"), or -1
+int ce_parse_step(const CeTuning* tuning, const char* name);
+
+// --- Equal loudness ---
+
+// Gain that makes a tone at this frequency as loud as 1 kHz on the ISO 226:2003 contour
+// for phon (capped boost; phon <= 0 gives 1)
+double ce_loudness_gain(double frequency, double phon);
+
+void ce_loudness_table(const CeTuning* tuning, double phon, double table[CE_NUM_OCTAVES][CE_MAX_TUNING_STEPS]);
+
+// --- Note pool and turns ---
+
+// Notes of the major scales on the given roots within the octave range, sorted by
+// frequency without duplicates. A tuning that is not 12-step has no major scale, so its
+// pool is every step in the range and the roots are only checked. Returns the pool size,
+// or -1 with a message in error.
+int ce_build_pool(const CeTuning* tuning, const char* const* roots, int num_roots, int range_low, int range_high,
+                  CeNote* pool, int max_pool, char* error, int error_size);
+
+// Small PRNG whose whole state is the caller's uint32_t (seed with any value)
+uint32_t ce_random(uint32_t* state);
+
+// Pick up to count notes with distinct steps, sorted by frequency. Returns how many.
+int ce_select_notes(const CeNote* pool, int pool_size, int count, CeNote* selected, uint32_t* rng);
+
+void ce_shuffle_notes(CeNote* notes, int count, uint32_t* rng);
+
+// 1 if every guessed step matches the answer at the same position
+int ce_judge(const CeNote* answers, const int* guessed_steps, int count);
+
+// --- Synthesis ---
+
+// Add num_voices voices, each at its own amplitude, into buffer[0, length), starting at
+// frame start_frame of the sound so long renders can be produced in pieces. Sine voices
+// are exact; saw, square and triangle are band-limited with PolyBLEP/PolyBLAMP. Sine voices
+// well below the Nyquist frequency are rendered at a fraction of sample_rate and brought up
+// to it by half-band interpolators. Pluck is ce_render_plucked with the default controls and
+// only starts at frame 0; render it in pieces with CePluckStrings. Returns 0 if *cancel was
+// raised part way through, or for pluck with start_frame != 0.
+int ce_render_voices(const double* frequencies, const float* amplitudes, int num_voices, int timbre, int sample_rate,
+                     long start_frame, float* buffer, int length, const atomic_int* cancel);
+
+// ce_render_voices with every voice at the full sample_rate: the reference the multi-rate
+// path is measured against
+int ce_render_voices_full_rate(const double* frequencies, const float* amplitudes, int num_voices, int timbre,
+                               int sample_rate, long start_frame, float* buffer, int length,
+                               const atomic_int* cancel);
+
+// ce_render_voices renders this voice at sample_rate / divisor (a power of two, 1 = full rate)
+int ce_voice_rate_divisor(double frequency, int timbre, int sample_rate);
+
+// Peak amplitude of one voice in a chord of num_voices: its equal-loudness gain, with the
+// chord level falling as 1/sqrt(num_voices) so its loudness stays roughly constant
+double ce_voice_amplitude(double loudness_gain, int num_voices);
+
+// Plucked-string (extended Karplus-Strong) controls, each 0-1
+typedef struct {
+    double damping;      // 0 rings for about 8 s, 1 stops within 0.2 s (fundamental, -60 dB)
+    double brightness;   // 0 is a dark, thumb-like pluck, 1 a bright pick with slow treble decay
+} CePluck;
+
+// Add plucked-string voices into buffer[0, length), starting from the pluck. Each string
+// is a delay line with a one-zero loss filter and a first-order allpass that tunes the loop
+// to the exact period, so pitch matches the frequency across all octaves. NULL pluck uses
+// the defaults. Returns 0 if *cancel was raised part way through or memory ran out.
+int ce_render_plucked(const double* frequencies, const float* amplitudes, int num_voices, const CePluck* pluck,
+                      int sample_rate, float* buffer, int length, const atomic_int* cancel);
+
+// Plucked strings owned by the caller, for sounds rendered in pieces: each render carries
+// on from where the last one stopped. Create allocates delay lines for up to max_voices
+// strings (at most CE_NUM_NOTES) no lower than lowest_frequency, or returns NULL; pluck
+// restarts the strings without allocating, so a host can pluck once per chord from its
+// audio thread. It returns 0, leaving the strings as they were, if there are too many
+// voices or one is lower than the strings were created for.
+typedef struct CePluckStrings CePluckStrings;
+
+CePluckStrings* ce_pluck_strings_create(int max_voices, double lowest_frequency, int sample_rate);
+
+int ce_pluck_strings_pluck(CePluckStrings* strings, const double* frequencies, const float* amplitudes,
+                           int num_voices, const CePluck* pluck);
+
+// Add the next length samples of the plucked strings into buffer. Returns 0 if *cancel was
+// raised part way through.
+int ce_pluck_strings_render(CePluckStrings* strings, float* buffer, int length, const atomic_int* cancel);
+
+void ce_pluck_strings_destroy(CePluckStrings* strings);
+
+// --- Games ---
+
+typedef struct {
+    const char* const* scales;   // major-scale roots, e.g. {"C", "E"}
+    int num_scales;
+    int notes_per_turn;
+    int range_low;               // octaves
+    int range_high;
+    int turns;
+    const char* tuning;          // NULL = "equal"
+    double a4_hz;                // 0 = CE_DEFAULT_A4
+    double loudness_phon;        // 0 = no equal-loudness compensation
+    const CeTuning* tuning_table;                         // prebuilt for tuning/a4_hz, e.g. from a cache; NULL = build
+    const double (*loudness_table)[CE_MAX_TUNING_STEPS];  // prebuilt for loudness_phon; NULL = build
+    int timbre;
+    const CePluck* pluck;        // CE_TIMBRE_PLUCK controls; NULL = defaults
+    int sample_rate;             // 0 = 48000
+    int shuffle_order;           // present notes in random order instead of low to high
+    uint32_t seed;
+} CeConfig;
+
+typedef struct {
+    long turns;
+    long correct;
+    long incorrect;
+    long repeats;
+    long solos;
+    long deletes;
+    long invalid;
+    long quits;
+} CeStats;
+
+typedef enum {
+    CE_EVENT_NONE,        // waiting for input
+    CE_EVENT_TURN_START,  // a new chord is ready: ce_turn_notes(), ce_render()
+    CE_EVENT_GUESS,       // a guess was accepted at 'index'
+    CE_EVENT_DELETE,      // the last guess was removed
+    CE_EVENT_INVALID,     // input was not a note or command
+    CE_EVENT_REPEAT,      // player asked to hear the chord again
+    CE_EVENT_SOLO,        // player asked to hear the notes one by one
+    CE_EVENT_TURN_END,    // all guesses are in; 'correct' holds the verdict
+    CE_EVENT_QUIT,        // player quit; the game is over
+    CE_EVENT_GAME_OVER    // all turns played
+} CeEventType;
+
+typedef struct {
+    CeEventType type;
+    int turn;             // 1-based
+    int index;            // guess position for GUESS
+    int correct;          // for TURN_END
+} CeEvent;
+
+typedef struct ChordEngine ChordEngine;
+
+// Returns NULL with a message in error if the configuration cannot make a game
+ChordEngine* ce_create(const CeConfig* config, char* error, int error_size);
+
+void ce_destroy(ChordEngine* engine);
+
+// Queue one line of player input ("C#", "r", "s", "x", "q"). Never blocks; returns 0 if
+// the queue is full.
+int ce_input(ChordEngine* engine, const char* line);
+
+// Advance the game by one event. Returns 0 (event->type CE_EVENT_NONE) when it needs
+// input, or after the game is over.
+int ce_step(ChordEngine* engine, CeEvent* event);
+
+// Notes of the current turn, and of the next one so hosts can prepare its audio early
+const CeNote* ce_turn_notes(const ChordEngine* engine, int* count);
+const CeNote* ce_next_turn_notes(const ChordEngine* engine, int* count);
+
+// Position of the next guess within the current turn
+int ce_guess_index(const ChordEngine* engine);
+
+// Steps guessed so far in the current turn (pitch classes in 12-step tunings)
+const int* ce_guesses(const ChordEngine* engine, int* count);
+
+const CeStats* ce_stats(const ChordEngine* engine);
+
+const CeNote* ce_pool(const ChordEngine* engine, int* size);
+
+// Render the next frames of the current turn's chord (CE_CHORD_SECONDS long), with
+// equal-loudness voice gains. Returns the number of frames written; 0 once it has all
+// been played. CE_EVENT_TURN_START and CE_EVENT_REPEAT rewind it.
+int ce_render(ChordEngine* engine, float* out, int frames);
+
+#endif
@@ -0,0 +1,90 @@
+// chordshm.h - layout of the ChordGame shared-memory audio ring.
+//
+// With -output shm:<name>, ChordGame renders its output blocks straight into a POSIX
+// shared-memory object (shm_open(<name>)) instead of a PortAudio stream. A mixer process
+// maps the same object and reads the samples in place, with no copies and no sound server
+// in between. This header is all a consumer needs; shm_consumer.c is a reference one:
+//
+//     cc -O2 shm_consumer.c -o shm_consumer -lm
+//
+// Layout (all offsets from the start of the mapping, little-endian host order):
+//
+//     0                  ChordShmHeader
+//     header_size        slot 0: ChordShmSlot, then frames_per_slot * channels float32
+//     + slot_size        slot 1 ...
+//     ...                slot slot_count - 1
+//
+// The ring is single-producer, single-consumer and lock-free. write_index and read_index
+// count slots published and consumed since creation and wrap at 2^32; slot i lives at
+// index i % slot_count (slot_count is a power of two). The producer owns slots
+// read_index + slot_count > i >= write_index; the consumer owns read_index <= i < write_index.
+//
+// Producer: wait until write_index - read_index < slot_count, fill the slot, then store
+// write_index + 1 (release) and, if consumer_waiting is set, FUTEX_WAKE write_index.
+// Consumer: if read_index == write_index, set consumer_waiting, re-check, and FUTEX_WAIT on
+// write_index; read the slot (acquire on write_index), then store read_index + 1 (release)
+// and FUTEX_WAKE read_index if producer_waiting is set. The futex words are 32-bit and
+// live in the shared mapping, so the non-private futex operations work across processes.
+//
+// A consumer stores its pid in consumer_pid while attached. With none attached, the
+// producer drops a block at once instead of waiting for a full ring to drain. Slots whose
+// samples are all zero carry CHORDSHM_FLAG_SILENT, so a mixer can skip them.
+
+#ifndef CHORDSHM_H
+#define CHORDSHM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define CHORDSHM_MAGIC 0x4d534743u   // "CGSM"
+#define CHORDSHM_VERSION 1
+#define CHORDSHM_DEFAULT_NAME "/chordgame"
+#define CHORDSHM_ALIGN 64
+
+#define CHORDSHM_FLAG_SILENT 1u      // every sample in the slot is zero
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;            // offset of slot 0
+    uint32_t slot_size;              // bytes per slot, a multiple of CHORDSHM_ALIGN
+    uint32_t slot_count;             // power of two
+    uint32_t frames_per_slot;
+    uint32_t channels;               // 1: mono float32
+    uint32_t sample_rate;
+    _Atomic int32_t producer_pid;    // 0 once the producer has exited
+    uint32_t reserved[7];
+
+    _Alignas(CHORDSHM_ALIGN) _Atomic uint32_t write_index;   // futex: slots published
+    _Atomic uint32_t consumer_waiting;
+    _Atomic uint64_t overruns;       // blocks dropped because the ring stayed full
+
+    _Alignas(CHORDSHM_ALIGN) _Atomic uint32_t read_index;    // futex: slots consumed
+    _Atomic uint32_t producer_waiting;
+    _Atomic int32_t consumer_pid;    // 0 = no consumer attached
+} ChordShmHeader;
+
+typedef struct {
+    uint64_t frame;                  // stream position of the first sample
+    uint64_t publish_ns;             // CLOCK_MONOTONIC when the slot was published
+    uint64_t play_ns;                // CLOCK_MONOTONIC at which the first sample is due
+    uint32_t frames;                 // valid frames, at most frames_per_slot
+    uint32_t flags;
+    uint32_t reserved[8];
+} ChordShmSlot;
+
+// Slot i of the ring (any index; it is reduced modulo slot_count)
+static inline ChordShmSlot* chordshm_slot(ChordShmHeader* header, uint32_t index) {
+    return (ChordShmSlot*)((unsigned char*)header + header->header_size
+                           + (uint64_t)(index & (header->slot_count - 1)) * header->slot_size);
+}
+
+static inline float* chordshm_samples(ChordShmSlot* slot) {
+    return (float*)(slot + 1);
+}
+
+static inline uint64_t chordshm_map_size(const ChordShmHeader* header) {
+    return header->header_size + (uint64_t)header->slot_count * header->slot_size;
+}
+
+#endif
@@ -0,0 +1,186 @@
+// shm_consumer.c - reference consumer for ChordGame's shared-memory output (chordshm.h).
+//
+// Attaches to the ring by name, reads each block in place and releases it, the way a
+// mixer would. Optionally writes the PCM to a file (raw mono float32 at the ring's sample
+// rate) and prints a level and timing line once a second.
+//
+// Build: cc -O2 shm_consumer.c -o shm_consumer -lm
+// Usage: shm_consumer [-name /chordgame] [-out file.f32] [-seconds n] [-quiet]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chordshm.h"
+
+#define ATTACH_RETRY_MS 100
+#define WAIT_TIMEOUT_NS 100000000L  // re-check for a departed producer this often
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_signal(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void futex_wait(_Atomic uint32_t* word, uint32_t expected, long timeout_ns) {
+    struct timespec timeout = { timeout_ns / 1000000000L, timeout_ns % 1000000000L };
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* word) {
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+// Map the ring once the producer has created and initialised it
+static ChordShmHeader* attach(const char* name, size_t* map_size) {
+    while (!stop_requested) {
+        int fd = shm_open(name, O_RDWR, 0);
+        struct stat info;
+        if (fd != -1 && fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(ChordShmHeader)) {
+            ChordShmHeader* ring = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (ring == MAP_FAILED) {
+                printf("Error: Could not map %s: %s\n", name, strerror(errno));
+                return NULL;
+            }
+            if (ring->magic == CHORDSHM_MAGIC && ring->version == CHORDSHM_VERSION
+                && chordshm_map_size(ring) <= (uint64_t)info.st_size) {
+                atomic_thread_fence(memory_order_acquire);
+                *map_size = (size_t)info.st_size;
+                return ring;
+            }
+            munmap(ring, (size_t)info.st_size);
+        } else if (fd != -1) {
+            close(fd);
+        }
+        usleep(ATTACH_RETRY_MS * 1000);
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    const char* name = CHORDSHM_DEFAULT_NAME;
+    const char* out_path = NULL;
+    double seconds = 0.0;  // 0 = until the producer exits
+    int quiet = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "-out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-quiet") == 0) {
+            quiet = 1;
+        } else {
+            printf("Usage: %s [-name /chordgame] [-out file.f32] [-seconds n] [-quiet]\n", argv[0]);
+            return 1;
+        }
+    }
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    FILE* out = NULL;
+    if (out_path != NULL && (out = fopen(out_path, "wb")) == NULL) {
+        printf("Error: Could not open %s\n", out_path);
+        return 1;
+    }
+
+    size_t map_size = 0;
+    ChordShmHeader* ring = attach(name, &map_size);
+    if (ring == NULL) {
+        return 1;
+    }
+    printf("Attached to %s: %u Hz, %u channel(s), %u slots of %u frames\n", name, ring->sample_rate,
+           ring->channels, ring->slot_count, ring->frames_per_slot);
+    atomic_store(&ring->consumer_pid, (int32_t)getpid());
+
+    uint32_t read = atomic_load(&ring->write_index);  // start at the live edge
+    atomic_store(&ring->read_index, read);
+    uint64_t total_frames = 0, blocks = 0, window_blocks = 0;
+    uint64_t window_latency_ns = 0, window_max_latency_ns = 0;
+    double window_square_sum = 0.0;
+    float window_peak = 0.0f;
+    uint64_t window_start = monotonic_ns();
+    uint64_t stop_frames = (uint64_t)(seconds * ring->sample_rate);
+
+    while (!stop_requested && (stop_frames == 0 || total_frames < stop_frames)) {
+        uint32_t write = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+        if (read == write) {
+            if (atomic_load(&ring->producer_pid) == 0) {
+                break;  // producer exited and the ring is drained
+            }
+            atomic_store(&ring->consumer_waiting, 1);
+            if (atomic_load(&ring->write_index) == read) {
+                futex_wait(&ring->write_index, read, WAIT_TIMEOUT_NS);
+            }
+            atomic_store(&ring->consumer_waiting, 0);
+            continue;
+        }
+
+        // The slot is ours until read_index moves past it: read the samples in place
+        ChordShmSlot* slot = chordshm_slot(ring, read);
+        const float* samples = chordshm_samples(slot);
+        uint64_t latency_ns = monotonic_ns() - slot->publish_ns;
+        for (uint32_t i = 0; i < slot->frames && !(slot->flags & CHORDSHM_FLAG_SILENT); i++) {
+            float magnitude = fabsf(samples[i]);
+            window_peak = magnitude > window_peak ? magnitude : window_peak;
+            window_square_sum += (double)samples[i] * samples[i];
+        }
+        if (out != NULL) {
+            fwrite(samples, sizeof(float), (size_t)slot->frames * ring->channels, out);
+        }
+        total_frames += slot->frames;
+        blocks++;
+        window_blocks++;
+        window_latency_ns += latency_ns;
+        window_max_latency_ns = latency_ns > window_max_latency_ns ? latency_ns : window_max_latency_ns;
+
+        atomic_store(&ring->read_index, ++read);
+        if (atomic_load(&ring->producer_waiting)) {
+            futex_wake(&ring->read_index);
+        }
+
+        uint64_t now = monotonic_ns();
+        if (!quiet && now - window_start >= 1000000000ULL) {
+            uint64_t window_frames = window_blocks * ring->frames_per_slot;
+            double rms = window_frames > 0 ? sqrt(window_square_sum / window_frames) : 0.0;
+            printf("%8.1f s | peak %6.1f dBFS | rms %6.1f dBFS | latency avg %6.1f us max %6.1f us | dropped %llu\n",
+                   (double)total_frames / ring->sample_rate, 20.0 * log10(window_peak + 1e-9), 20.0 * log10(rms + 1e-9),
+                   window_latency_ns / 1000.0 / window_blocks, window_max_latency_ns / 1000.0,
+                   (unsigned long long)atomic_load(&ring->overruns));
+            fflush(stdout);
+            window_blocks = 0;
+            window_latency_ns = window_max_latency_ns = 0;
+            window_square_sum = 0.0;
+            window_peak = 0.0f;
+            window_start = now;
+        }
+    }
+
+    atomic_store(&ring->consumer_pid, 0);
+    printf("Read %llu blocks, %.1f s of audio\n", (unsigned long long)blocks, (double)total_frames / ring->sample_rate);
+    munmap(ring, map_size);
+    if (out != NULL) {
+        fclose(out);
+    }
+    return 0;
+}